@@ -0,0 +1,308 @@
+/*
+ * PCI Finger-Print Device Assignment
+ *
+ * Copyright (c) 2016-2024 Alexei A. Smekalkine <ikle@ikle.ru>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pfp-assign.h"
+
+#define NONE  ((size_t) -1)
+
+/* pattern rule with its ordinal number, include rules are not counted */
+struct member {
+	const struct pfp_rule *rule;
+	size_t n;
+};
+
+/* class of equal pattern rules, they are matched by the same devices */
+struct group {
+	const struct pfp_rule *rule;
+	size_t need, load;	/* number of rules and of assigned devices */
+	size_t first, count;	/* candidate devices in edge array */
+	size_t member;		/* first rule of group in member array */
+};
+
+struct assign {
+	struct member *set;	/* pattern rules ordered by key */
+	struct group *group;
+	size_t groups;
+	size_t *edge, edges, avail;
+	int failed;
+	size_t *owner;		/* group of device or NONE */
+	size_t *seen, stamp;	/* last search visited device */
+};
+
+static int int_cmp (int a, int b)
+{
+	return a < b ? -1 : a > b ? 1 : 0;
+}
+
+static int sbdf_cmp (const struct pfp_sbdf *a, const struct pfp_sbdf *b)
+{
+	int x;
+
+	if ((x = int_cmp (a->segment, b->segment)) != 0 ||
+	    (x = int_cmp (a->bus,     b->bus))     != 0 ||
+	    (x = int_cmp (a->device,  b->device))  != 0)
+		return x;
+
+	return int_cmp (a->function, b->function);
+}
+
+/*
+ * Order of pattern rules by all the fields used by match, rules with
+ * path first: they take their devices before wildcard rules do, thus a
+ * rule left unassigned is a wildcard one if possible.
+ */
+static int key_cmp (const void *pa, const void *pb)
+{
+	const struct pfp_rule *a = ((const struct member *) pa)->rule;
+	const struct pfp_rule *b = ((const struct member *) pb)->rule;
+	int x;
+
+	if (a->path != NULL && b->path != NULL)
+		x = strcmp (a->path, b->path);
+	else
+		x = (b->path != NULL) - (a->path != NULL);
+
+	if (x != 0 ||
+	    (x = sbdf_cmp (&a->parent, &b->parent)) != 0 ||
+	    (x = sbdf_cmp (&a->slot,   &b->slot))   != 0 ||
+	    (x = int_cmp (a->class,     b->class))     != 0 ||
+	    (x = int_cmp (a->interface, b->interface)) != 0 ||
+	    (x = int_cmp (a->vendor,    b->vendor))    != 0 ||
+	    (x = int_cmp (a->device,    b->device))    != 0 ||
+	    (x = int_cmp (a->svendor,   b->svendor))   != 0 ||
+	    (x = int_cmp (a->sdevice,   b->sdevice))   != 0)
+		return x;
+
+	return memcmp (&a->wild, &b->wild, sizeof (a->wild));
+}
+
+static int make_groups (struct assign *o, const struct pfp_rule *const lists[],
+			size_t count)
+{
+	const struct pfp_rule *r;
+	struct member *set;
+	size_t n = 0, i;
+
+	for (i = 0; i < count; ++i)
+		for (r = lists[i]; r != NULL; r = r->next)
+			n += r->include == NULL;
+
+	if ((set = malloc (sizeof (set[0]) * (n + 1))) == NULL)
+		return 0;
+
+	if ((o->group = malloc (sizeof (o->group[0]) * (n + 1))) == NULL) {
+		free (set);
+		return 0;
+	}
+
+	for (n = 0, i = 0; i < count; ++i)
+		for (r = lists[i]; r != NULL; r = r->next)
+			if (r->include == NULL) {
+				set[n].rule = r;
+				set[n].n    = n;
+				++n;
+			}
+
+	qsort (set, n, sizeof (set[0]), key_cmp);
+
+	for (o->groups = 0, i = 0; i < n; ++i)
+		if (i > 0 && key_cmp (set + i - 1, set + i) == 0)
+			++o->group[o->groups - 1].need;
+		else {
+			o->group[o->groups].rule   = set[i].rule;
+			o->group[o->groups].need   = 1;
+			o->group[o->groups].load   = 0;
+			o->group[o->groups].member = i;
+			++o->groups;
+		}
+
+	o->set = set;
+	return 1;
+}
+
+static void add_edge (const struct pfp_rule *r, size_t index, void *cookie)
+{
+	struct assign *o = cookie;
+	const size_t avail = o->avail > 0 ? o->avail * 2 : 64;
+	size_t *p;
+
+	if (o->failed)
+		return;
+
+	if (o->edges >= o->avail) {
+		if ((p = realloc (o->edge, sizeof (p[0]) * avail)) == NULL) {
+			o->failed = 1;
+			return;
+		}
+
+		o->edge  = p;
+		o->avail = avail;
+	}
+
+	o->edge[o->edges++] = index;
+}
+
+/* candidate devices of every group are looked up in the index once */
+static int make_edges (struct assign *o, const struct pfp_index *index)
+{
+	struct group *g;
+
+	o->edge  = NULL;
+	o->edges = o->avail = 0;
+	o->failed = 0;
+
+	for (g = o->group; g < o->group + o->groups; ++g) {
+		g->first = o->edges;
+		pfp_index_match (index, g->rule, add_edge, o);
+
+		if (o->failed)
+			return 0;
+
+		g->count = o->edges - g->first;
+	}
+
+	return 1;
+}
+
+/* find an alternating path from group to a free device */
+static int augment (struct assign *o, size_t g)
+{
+	const struct group *p = o->group + g;
+	size_t i, d;
+
+	for (i = p->first; i < p->first + p->count; ++i) {
+		if (o->seen[d = o->edge[i]] == o->stamp)
+			continue;
+
+		o->seen[d] = o->stamp;
+
+		if (o->owner[d] == NONE || augment (o, o->owner[d])) {
+			o->owner[d] = g;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Every group takes free candidates first, that is all the work unless
+ * wildcard patterns compete for devices. Groups left short of devices
+ * then look for augmenting paths, a failed search is not repeated as
+ * nothing changed since.
+ */
+static size_t solve (struct assign *o)
+{
+	struct group *g;
+	size_t i, d, rank = 0;
+
+	for (g = o->group; g < o->group + o->groups; ++g)
+		for (i = g->first; i < g->first + g->count && g->load < g->need;
+		     ++i)
+			if (o->owner[d = o->edge[i]] == NONE) {
+				o->owner[d] = g - o->group;
+				++g->load;
+			}
+
+	for (g = o->group; g < o->group + o->groups; ++g) {
+		while (g->load < g->need && g->load < g->count) {
+			++o->stamp;
+
+			if (!augment (o, g - o->group))
+				break;
+
+			++g->load;
+		}
+
+		rank += g->load;
+	}
+
+	return rank;
+}
+
+/* equal rules of group take its devices in order of device list */
+static void get_match (struct assign *o, size_t count, size_t *match)
+{
+	struct group *g;
+	size_t d;
+
+	for (d = 0; d < count; ++d)
+		if (o->owner[d] == NONE)
+			match[d] = NONE;
+		else {
+			g = o->group + o->owner[d];
+			match[d] = o->set[g->member + --g->load].n;
+		}
+}
+
+int pfp_assign_map (const struct pfp_index *index,
+		    const struct pfp_rule *const lists[], size_t count,
+		    size_t *match, size_t *rank)
+{
+	struct assign o;
+	size_t i;
+	int ok = 0;
+
+	if (!make_groups (&o, lists, count))
+		return 0;
+
+	if (!make_edges (&o, index))
+		goto no_edges;
+
+	o.owner = malloc (sizeof (o.owner[0]) * (index->count * 2 + 1));
+
+	if (o.owner == NULL)
+		goto no_owner;
+
+	o.seen  = o.owner + index->count;
+	o.stamp = 0;
+
+	for (i = 0; i < index->count; ++i) {
+		o.owner[i] = NONE;
+		o.seen[i]  = 0;
+	}
+
+	*rank = solve (&o);
+	ok = 1;
+
+	if (match != NULL)
+		get_match (&o, index->count, match);
+
+	free (o.owner);
+no_owner:
+no_edges:
+	free (o.edge);
+	free (o.group);
+	free (o.set);
+	return ok;
+}
+
+int pfp_assign (const struct pfp_index *index,
+		const struct pfp_rule *const lists[], size_t count,
+		size_t *rank)
+{
+	return pfp_assign_map (index, lists, count, NULL, rank);
+}
+
+size_t pfp_rule_match (const struct pfp_rule *o, const struct pfp_rule *pattern)
+{
+	struct pfp_index index;
+	size_t rank;
+
+	if (!pfp_index_init (&index, o))
+		return 0;
+
+	if (!pfp_assign (&index, &pattern, 1, &rank))
+		rank = 0;
+
+	pfp_index_fini (&index);
+	return rank;
+}
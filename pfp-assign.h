@@ -0,0 +1,39 @@
+/*
+ * PCI Finger-Print Device Assignment
+ *
+ * Copyright (c) 2016-2024 Alexei A. Smekalkine <ikle@ikle.ru>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef PFP_ASSIGN_H
+#define PFP_ASSIGN_H  1
+
+#include "pfp-index.h"
+
+/*
+ * Maximum one-to-one assignment of indexed devices to rules of a set of
+ * pattern lists: a device is counted for one pattern rule at most and a
+ * pattern rule for one device, thus duplicated rules need as many
+ * devices. Rank is set to the number of assigned pairs. Returns zero
+ * with errno set on failure.
+ */
+int pfp_assign (const struct pfp_index *index,
+		const struct pfp_rule *const lists[], size_t count,
+		size_t *rank);
+
+/*
+ * The same with the assignment itself: match of every indexed device is
+ * set to ordinal number of its pattern rule (rules of all the lists in
+ * order, include rules are not counted) or to (size_t) -1 if the device
+ * is left unassigned.
+ */
+int pfp_assign_map (const struct pfp_index *index,
+		    const struct pfp_rule *const lists[], size_t count,
+		    size_t *match, size_t *rank);
+
+/* return number of assigned pairs, zero with errno set on failure */
+size_t
+pfp_rule_match (const struct pfp_rule *o, const struct pfp_rule *pattern);
+
+#endif  /* PFP_ASSIGN_H */
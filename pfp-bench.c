@@ -0,0 +1,247 @@
+/*
+ * PCI Finger-Print Parser Benchmark
+ *
+ * Copyright (c) 2016-2024 Alexei A. Smekalkine <ikle@ikle.ru>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pfp-format.h"
+#include "pfp-parser.h"
+
+/*
+ * Allocations are counted by wrapping allocator calls at link time:
+ * -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=strdup
+ */
+static size_t allocs;
+
+void *__real_malloc (size_t size);
+void *__real_calloc (size_t count, size_t size);
+void *__real_realloc (void *p, size_t size);
+char *__real_strdup (const char *s);
+
+void *__wrap_malloc (size_t size)
+{
+	++allocs;
+	return __real_malloc (size);
+}
+
+void *__wrap_calloc (size_t count, size_t size)
+{
+	++allocs;
+	return __real_calloc (count, size);
+}
+
+void *__wrap_realloc (void *p, size_t size)
+{
+	++allocs;
+	return __real_realloc (p, size);
+}
+
+char *__wrap_strdup (const char *s)
+{
+	++allocs;
+	return __real_strdup (s);
+}
+
+static unsigned get_random (unsigned *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 8;
+}
+
+/*
+ * Synthetic rule: path or slot, class, identifiers and sometimes a
+ * comment block. Pathological rules have deep paths and huge comments.
+ */
+static int gen_rule (struct pfp_buf *o, unsigned *seed, int hard)
+{
+	const unsigned x = get_random (seed);
+	const size_t depth = hard ? 512 : 1 + x % 4;
+	const size_t comment = hard ? 65536 : x % 8 == 0 ? 64 : 0;
+	char chunk[64];
+	size_t i;
+	int ok = 1;
+
+	if (comment > 0) {
+		memset (chunk, 'x', sizeof (chunk));
+		ok &= pfp_buf_write (o, "# ", 2);
+
+		for (i = 0; i < comment; i += sizeof (chunk))
+			ok &= pfp_buf_write (o, chunk, sizeof (chunk));
+
+		ok &= pfp_buf_write (o, "\n", 1);
+	}
+
+	if (x % 3 == 0)
+		ok &= pfp_buf_printf (o, "slot\t= %x:%x.%o\n",
+				      x % 256, x % 32, x % 8);
+	else {
+		ok &= pfp_buf_printf (o, "path\t= %x", x % 16);
+
+		for (i = 0; i < depth; ++i)
+			ok &= pfp_buf_printf (o, "/%x.%o", (x >> i) % 32,
+					      (x >> i) % 8);
+
+		ok &= pfp_buf_printf (o, " (Synthetic Device %u)\n", x);
+	}
+
+	ok &= pfp_buf_printf (o, "class\t= %04x.%x\n"
+				 "vendor\t= %04x\n"
+				 "device\t= %04x\n",
+			      x % 0x1000, x % 0x10, x % 0x10000, x >> 8 & 0xffff);
+
+	if (x % 2 == 0)
+		ok &= pfp_buf_printf (o, "svendor\t= %04x\n"
+					 "sdevice\t= %04x\n",
+				      x >> 4 & 0xffff, x >> 12 & 0xffff);
+
+	return ok && pfp_buf_write (o, "\n", 1);
+}
+
+static double now (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct pfp_rule *
+parse (struct pfp_parser *p, const struct pfp_buf *text)
+{
+	FILE *f;
+	struct pfp_rule *r;
+	const char *reason;
+	int line;
+
+	if ((f = fmemopen (text->data, text->len, "r")) == NULL) {
+		perror ("pfp-bench");
+		return NULL;
+	}
+
+	pfp_parser_reset (p, f);
+
+	if ((r = pfp_parser_run (p)) == NULL &&
+	    (reason = pfp_parser_error (p, &line)) != NULL)
+		fprintf (stderr, "E:%d: %s\n", line, reason);
+
+	fclose (f);
+	return r;
+}
+
+static void report (const char *what, double time, size_t size,
+		    size_t rules, size_t count)
+{
+	printf ("%s:\t%.1f MiB/s, %.2f Mrules/s, %.2f allocs/rule\n", what,
+		size / time / (1 << 20), rules / time / 1e6,
+		(double) count / rules);
+}
+
+int main (int argc, char *argv[])
+{
+	const char *out = NULL;
+	size_t count = 0, runs = 5, i, n = 0, a;
+	unsigned seed = 1;
+	int hard = 0;
+	struct pfp_buf text, bin;
+	struct pfp_parser *p;
+	struct pfp_rule *r;
+	double t;
+	FILE *f;
+
+	for (; argc > 1 && argv[1][0] == '-'; --argc, ++argv)
+		if (strcmp (argv[1], "-x") == 0)
+			hard = 1;
+		else if (strcmp (argv[1], "-n") == 0 && argc > 2) {
+			count = strtoul (argv[2], NULL, 0);
+			--argc, ++argv;
+		}
+		else if (strcmp (argv[1], "-r") == 0 && argc > 2) {
+			runs = strtoul (argv[2], NULL, 0);
+			--argc, ++argv;
+		}
+		else if (strcmp (argv[1], "-o") == 0 && argc > 2) {
+			out = argv[2];
+			--argc, ++argv;
+		}
+		else
+			goto usage;
+
+	if (argc > 1 || runs == 0)
+		goto usage;
+
+	if (count == 0)
+		count = hard ? 1000 : 100000;
+
+	pfp_buf_init (&text);
+	pfp_buf_init (&bin);
+
+	for (i = 0; i < count; ++i)
+		if (!gen_rule (&text, &seed, hard))
+			goto no_mem;
+
+	if (out != NULL) {
+		if ((f = fopen (out, "w")) == NULL || !pfp_buf_flush (&text, f))
+			goto no_write;
+
+		fclose (f);
+		return 0;
+	}
+
+	if ((p = pfp_parser_alloc (NULL)) == NULL)
+		goto no_mem;
+
+	printf ("input:\t%.1f MiB, %zu rules, %zu runs\n",
+		text.len / (double) (1 << 20), count, runs);
+
+	for (a = allocs, t = now (), i = 0; i < runs; ++i) {
+		if ((r = parse (p, &text)) == NULL)
+			goto no_parse;
+
+		n += pfp_rule_count (r);
+		pfp_rule_free (r);
+	}
+
+	report ("text", now () - t, text.len * runs, n, allocs - a);
+
+	if ((r = parse (p, &text)) == NULL)
+		goto no_parse;
+
+	if (!pfp_format (&bin, r, PFP_FORMAT_BIN, 0))
+		goto no_mem;
+
+	pfp_rule_free (r);
+
+	for (n = 0, a = allocs, t = now (), i = 0; i < runs; ++i) {
+		if ((r = pfp_format_load (bin.data, bin.len)) == NULL)
+			goto no_parse;
+
+		n += pfp_rule_count (r);
+		pfp_rule_free (r);
+	}
+
+	report ("bin", now () - t, bin.len * runs, n, allocs - a);
+
+	pfp_parser_free (p);
+	pfp_buf_fini (&bin);
+	pfp_buf_fini (&text);
+	return 0;
+no_parse:
+	fprintf (stderr, "pfp-bench: cannot parse generated input\n");
+	return 1;
+no_write:
+no_mem:
+	perror ("pfp-bench");
+	return 1;
+usage:
+	fprintf (stderr, "usage:\n"
+			 "\tpfp-bench [-x] [-n rules] [-r runs]\n"
+			 "\tpfp-bench [-x] [-n rules] -o out\n");
+	return 1;
+}
@@ -0,0 +1,21 @@
+/*
+ * PCI Finger-Print Built-in Corpus
+ *
+ * Copyright (c) 2016-2024 Alexei A. Smekalkine <ikle@ikle.ru>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef PFP_BUILTIN_H
+#define PFP_BUILTIN_H  1
+
+#include "pfp-corpus.h"
+
+/*
+ * Platform finger-prints compiled in by pfp-embed at build time: rules
+ * are kept in static tables with includes resolved, thus nothing is read
+ * or parsed to match against them. It is never freed.
+ */
+extern const struct pfp_corpus pfp_builtin;
+
+#endif  /* PFP_BUILTIN_H */
@@ -0,0 +1,409 @@
+/*
+ * PCI Finger-Print Parsed Corpus Cache
+ *
+ * Copyright (c) 2016-2024 Alexei A. Smekalkine <ikle@ikle.ru>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include "pfp-cache.h"
+#include "pfp-format.h"
+
+/*
+ * Cache file: magic, version and entry count followed by entries. Every
+ * entry is a path string, 64-bit device, inode, size, modification time
+ * seconds, 32-bit nanoseconds, and rules in binary form prefixed with
+ * its 32-bit length. All integers are little-endian.
+ */
+
+#define CACHE_MAGIC	"\x7f" "PFC"
+#define CACHE_VERSION	1
+
+struct entry {
+	char *path;
+	uint64_t dev, ino, size, sec;
+	uint32_t nsec;
+
+	const unsigned char *data;
+	size_t len;
+	void *own;  /* data allocated for this entry */
+
+	int used;
+};
+
+struct pfp_cache {
+	char *path;
+	struct pfp_buf image;
+
+	struct entry *set;
+	size_t count, avail;
+	size_t *table, size;  /* entry numbers plus one by path hash */
+
+	int dirty;
+};
+
+static void entry_fini (struct entry *o)
+{
+	free (o->path);
+	free (o->own);
+}
+
+static void entry_set_id (struct entry *o, const struct stat *st)
+{
+	o->dev  = st->st_dev;
+	o->ino  = st->st_ino;
+	o->size = st->st_size;
+	o->sec  = st->st_mtim.tv_sec;
+	o->nsec = st->st_mtim.tv_nsec;
+}
+
+static int entry_eq_id (const struct entry *o, const struct stat *st)
+{
+	return	o->dev  == (uint64_t) st->st_dev		&&
+		o->ino  == (uint64_t) st->st_ino		&&
+		o->size == (uint64_t) st->st_size		&&
+		o->sec  == (uint64_t) st->st_mtim.tv_sec	&&
+		o->nsec == (uint32_t) st->st_mtim.tv_nsec;
+}
+
+static unsigned hash_path (const char *path)
+{
+	unsigned h = 2166136261;
+
+	for (; *path != '\0'; ++path)
+		h = (h ^ (unsigned char) *path) * 16777619;  /* FNV-1a */
+
+	return h;
+}
+
+static void table_put (size_t *table, size_t size, const char *path,
+		       size_t n)
+{
+	size_t i;
+
+	for (i = hash_path (path) & (size - 1); table[i] != 0;
+	     i = (i + 1) & (size - 1)) {}
+
+	table[i] = n + 1;
+}
+
+static int table_grow (struct pfp_cache *o)
+{
+	const size_t size = o->size > 0 ? o->size * 2 : 128;
+	size_t *table, i;
+
+	if ((table = calloc (size, sizeof (table[0]))) == NULL)
+		return 0;
+
+	for (i = 0; i < o->count; ++i)
+		table_put (table, size, o->set[i].path, i);
+
+	free (o->table);
+	o->table = table;
+	o->size  = size;
+	return 1;
+}
+
+static struct entry *cache_add (struct pfp_cache *o, char *path)
+{
+	const size_t avail = o->avail > 0 ? o->avail * 2 : 64;
+	struct entry *p;
+
+	if (o->count >= o->avail) {
+		if ((p = realloc (o->set, sizeof (p[0]) * avail)) == NULL)
+			return NULL;
+
+		o->set   = p;
+		o->avail = avail;
+	}
+
+	if ((o->count + 1) * 2 > o->size && !table_grow (o))
+		return NULL;
+
+	table_put (o->table, o->size, path, o->count);
+
+	p = o->set + o->count++;
+	p->path = path;
+	p->own  = NULL;
+	p->used = 0;
+	return p;
+}
+
+static struct entry *cache_find (struct pfp_cache *o, const char *path)
+{
+	size_t i, n;
+
+	if (o->size == 0)
+		return NULL;
+
+	for (i = hash_path (path) & (o->size - 1); (n = o->table[i]) != 0;
+	     i = (i + 1) & (o->size - 1))
+		if (strcmp (o->set[n - 1].path, path) == 0)
+			return o->set + n - 1;
+
+	return NULL;
+}
+
+static int get_u64 (struct pfp_cursor *o, uint64_t *x)
+{
+	uint32_t lo, hi;
+
+	if (!pfp_cursor_get_u32 (o, &lo) || !pfp_cursor_get_u32 (o, &hi))
+		return 0;
+
+	*x = (uint64_t) hi << 32 | lo;
+	return 1;
+}
+
+static int put_u64 (struct pfp_buf *o, uint64_t x)
+{
+	return pfp_buf_put_u32 (o, x) && pfp_buf_put_u32 (o, x >> 32);
+}
+
+static int load_entry (struct pfp_cache *o, struct pfp_cursor *c)
+{
+	char *path = NULL;
+	uint32_t len;
+	struct entry *e;
+
+	if (!pfp_cursor_get_string (c, &path) || path == NULL ||
+	    (e = cache_add (o, path)) == NULL) {
+		free (path);
+		return 0;
+	}
+
+	if (!get_u64 (c, &e->dev)  || !get_u64 (c, &e->ino) ||
+	    !get_u64 (c, &e->size) || !get_u64 (c, &e->sec) ||
+	    !pfp_cursor_get_u32 (c, &e->nsec) ||
+	    !pfp_cursor_get_u32 (c, &len) || c->avail < len)
+		return 0;
+
+	e->data = c->p;
+	e->len  = len;
+
+	c->p     += len;
+	c->avail -= len;
+	return 1;
+}
+
+static int cache_load (struct pfp_cache *o)
+{
+	FILE *f;
+	char chunk[BUFSIZ];
+	size_t len;
+	struct pfp_cursor c;
+	uint32_t version, count;
+
+	if ((f = fopen (o->path, "rb")) == NULL)
+		return 0;
+
+	while ((len = fread (chunk, 1, sizeof (chunk), f)) > 0)
+		if (!pfp_buf_write (&o->image, chunk, len))
+			break;
+
+	fclose (f);
+
+	c.p     = (const void *) o->image.data;
+	c.avail = o->image.len;
+
+	if (c.avail < 4 || memcmp (c.p, CACHE_MAGIC, 4) != 0)
+		return 0;
+
+	c.p += 4, c.avail -= 4;
+
+	if (!pfp_cursor_get_u32 (&c, &version) || version != CACHE_VERSION ||
+	    !pfp_cursor_get_u32 (&c, &count))
+		return 0;
+
+	for (; count > 0; --count)
+		if (!load_entry (o, &c))
+			return 0;
+
+	return 1;
+}
+
+static void cache_reset (struct pfp_cache *o)
+{
+	size_t i;
+
+	for (i = 0; i < o->count; ++i)
+		entry_fini (o->set + i);
+
+	o->count = 0;
+	o->image.len = 0;
+
+	if (o->size > 0)
+		memset (o->table, 0, sizeof (o->table[0]) * o->size);
+}
+
+struct pfp_cache *pfp_cache_open (const char *path)
+{
+	struct pfp_cache *o;
+
+	if ((o = malloc (sizeof (*o))) == NULL)
+		return NULL;
+
+	if ((o->path = strdup (path)) == NULL)
+		goto no_path;
+
+	pfp_buf_init (&o->image);
+
+	o->set   = NULL;
+	o->count = o->avail = 0;
+	o->table = NULL;
+	o->size  = 0;
+	o->dirty = 0;
+
+	if (!cache_load (o)) {  /* missing or broken cache: start over */
+		cache_reset (o);
+		o->dirty = 1;
+	}
+
+	return o;
+no_path:
+	free (o);
+	return NULL;
+}
+
+static int save_entry (struct pfp_buf *o, const struct entry *e)
+{
+	return	pfp_buf_put_string (o, e->path)	&&
+		put_u64 (o, e->dev)		&&
+		put_u64 (o, e->ino)		&&
+		put_u64 (o, e->size)		&&
+		put_u64 (o, e->sec)		&&
+		pfp_buf_put_u32 (o, e->nsec)	&&
+		pfp_buf_put_u32 (o, e->len)	&&
+		pfp_buf_write (o, e->data, e->len);
+}
+
+static int cache_save (struct pfp_cache *o)
+{
+	struct pfp_buf b;
+	size_t i, count;
+	char *tmp;
+	FILE *f;
+	int ok = 0;
+
+	for (count = 0, i = 0; i < o->count; ++i)
+		count += o->set[i].used;
+
+	pfp_buf_init (&b);
+
+	if (!pfp_buf_write (&b, CACHE_MAGIC, 4) ||
+	    !pfp_buf_put_u32 (&b, CACHE_VERSION) ||
+	    !pfp_buf_put_u32 (&b, count))
+		goto no_data;
+
+	for (i = 0; i < o->count; ++i)
+		if (o->set[i].used && !save_entry (&b, o->set + i))
+			goto no_data;
+
+	if ((tmp = malloc (strlen (o->path) + 5)) == NULL)
+		goto no_data;
+
+	sprintf (tmp, "%s.new", o->path);
+
+	if ((f = fopen (tmp, "wb")) == NULL)
+		goto no_open;
+
+	ok = fwrite (b.data, 1, b.len, f) == b.len;
+	ok = (fclose (f) == 0) && ok && rename (tmp, o->path) == 0;
+
+	if (!ok)
+		unlink (tmp);
+no_open:
+	free (tmp);
+no_data:
+	pfp_buf_fini (&b);
+	return ok;
+}
+
+int pfp_cache_close (struct pfp_cache *o)
+{
+	struct stat st;
+	size_t i;
+	int ok = 1;
+
+	if (o == NULL)
+		return 1;
+
+	/* keep entries not visited by this run while their files exist */
+	for (i = 0; i < o->count; ++i)
+		if (!o->set[i].used && stat (o->set[i].path, &st) == 0 &&
+		    entry_eq_id (o->set + i, &st))
+			o->set[i].used = 1;
+		else if (!o->set[i].used)
+			o->dirty = 1;
+
+	if (o->dirty)
+		ok = cache_save (o);
+
+	cache_reset (o);
+	pfp_buf_fini (&o->image);
+	free (o->set);
+	free (o->table);
+	free (o->path);
+	free (o);
+	return ok;
+}
+
+int pfp_cache_get (struct pfp_cache *o, const char *path,
+		   const struct stat *st, struct pfp_rule **rules)
+{
+	struct entry *e;
+
+	if ((e = cache_find (o, path)) == NULL || !entry_eq_id (e, st))
+		return 0;
+
+	errno = 0;
+
+	if ((*rules = pfp_format_load (e->data, e->len)) == NULL && errno != 0)
+		return 0;  /* broken entry or no memory: parse it again */
+
+	e->used = 1;
+	return 1;
+}
+
+int pfp_cache_put (struct pfp_cache *o, const char *path,
+		   const struct stat *st, const struct pfp_rule *rules)
+{
+	struct pfp_buf b;
+	struct entry *e;
+	char *p;
+
+	pfp_buf_init (&b);
+
+	if (!pfp_format (&b, rules, PFP_FORMAT_BIN, 0))
+		goto no_data;
+
+	if ((e = cache_find (o, path)) == NULL) {
+		if ((p = strdup (path)) == NULL)
+			goto no_data;
+
+		if ((e = cache_add (o, p)) == NULL) {
+			free (p);
+			goto no_data;
+		}
+	}
+
+	free (e->own);
+
+	e->data = e->own = b.data;
+	e->len  = b.len;
+	e->used = 1;
+
+	entry_set_id (e, st);
+	o->dirty = 1;
+	return 1;
+no_data:
+	pfp_buf_fini (&b);
+	return 0;
+}
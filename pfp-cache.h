@@ -0,0 +1,35 @@
+/*
+ * PCI Finger-Print Parsed Corpus Cache
+ *
+ * Copyright (c) 2016-2024 Alexei A. Smekalkine <ikle@ikle.ru>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef PFP_CACHE_H
+#define PFP_CACHE_H  1
+
+#include <sys/stat.h>
+
+#include "pfp-rule.h"
+
+/*
+ * Cache file keeps parsed rules of finger-print files in binary form
+ * keyed by file path, device, inode, size and modification time.
+ */
+struct pfp_cache *pfp_cache_open (const char *path);
+
+/* write cache back if changed and free it */
+int pfp_cache_close (struct pfp_cache *o);
+
+/*
+ * Return zero if file is unknown or changed, otherwise set rules to the
+ * cached ones (NULL for empty finger-print)
+ */
+int pfp_cache_get (struct pfp_cache *o, const char *path,
+		   const struct stat *st, struct pfp_rule **rules);
+
+int pfp_cache_put (struct pfp_cache *o, const char *path,
+		   const struct stat *st, const struct pfp_rule *rules);
+
+#endif  /* PFP_CACHE_H */
@@ -0,0 +1,179 @@
+/*
+ * PCI Finger-Print Snapshot Classifier
+ *
+ * Copyright (c) 2016-2024 Alexei A. Smekalkine <ikle@ikle.ru>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "pfp-classify.h"
+#include "pfp-walk.h"
+
+#define MAX_WORKERS  256
+
+struct list {
+	struct pfp_snapshot *set;
+	size_t count, avail;
+};
+
+static int list_walker (const char *path, const struct stat *sb, void *cookie)
+{
+	struct list *o = cookie;
+	const size_t avail = o->avail > 0 ? o->avail * 2 : 256;
+	struct pfp_snapshot *p;
+
+	if (o->count >= o->avail) {
+		if ((p = realloc (o->set, sizeof (p[0]) * avail)) == NULL)
+			return 0;
+
+		o->set   = p;
+		o->avail = avail;
+	}
+
+	p = o->set + o->count;
+
+	if ((p->path = strdup (path)) == NULL)
+		return 0;
+
+	p->ok    = 0;
+	p->print = NULL;
+	p->rank  = 0;
+
+	++o->count;
+	return 1;
+}
+
+static int snapshot_cmp (const void *a, const void *b)
+{
+	const struct pfp_snapshot *p = a, *q = b;
+
+	return strcmp (p->path, q->path);
+}
+
+void pfp_snapshot_free (struct pfp_snapshot *o, size_t count)
+{
+	size_t i;
+
+	if (o == NULL)
+		return;
+
+	for (i = 0; i < count; ++i)
+		free (o[i].path);
+
+	free (o);
+}
+
+struct pool {
+	const struct pfp_corpus *corpus;
+	struct pfp_snapshot *set;
+	size_t count, next;
+	pthread_mutex_t lock;
+};
+
+static struct pfp_snapshot *pool_get (struct pool *o)
+{
+	struct pfp_snapshot *p = NULL;
+
+	pthread_mutex_lock (&o->lock);
+
+	if (o->next < o->count)
+		p = o->set + o->next++;
+
+	pthread_mutex_unlock (&o->lock);
+	return p;
+}
+
+static void classify (struct pfp_snapshot *o, const struct pfp_corpus *c,
+		      struct pfp_parser *parser)
+{
+	FILE *f;
+	struct pfp_rule *scan;
+	int line;
+
+	if ((f = fopen (o->path, "r")) == NULL)
+		return;
+
+	scan = pfp_load (parser, f);
+	fclose (f);
+
+	if (scan == NULL && pfp_parser_error (parser, &line) != NULL)
+		return;
+
+	o->ok = pfp_corpus_match (c, scan, &o->print, &o->rank);
+
+	pfp_rule_free (scan);
+}
+
+/*
+ * Every worker owns its parser with all the lexer buffers, thus the
+ * only shared state is the read-only corpus and the job counter.
+ */
+static void *worker (void *cookie)
+{
+	struct pool *o = cookie;
+	struct pfp_parser *parser;
+	struct pfp_snapshot *p;
+
+	if ((parser = pfp_parser_alloc (NULL)) == NULL)
+		return NULL;
+
+	while ((p = pool_get (o)) != NULL)
+		classify (p, o->corpus, parser);
+
+	pfp_parser_free (parser);
+	return NULL;
+}
+
+static void pool_run (struct pool *o, int workers)
+{
+	pthread_t t[MAX_WORKERS];
+	int i, n;
+
+	if (workers > MAX_WORKERS)
+		workers = MAX_WORKERS;
+
+	for (n = 0; n < workers - 1; ++n)
+		if (pthread_create (t + n, NULL, worker, o) != 0)
+			break;
+
+	worker (o);  /* use current thread as well */
+
+	for (i = 0; i < n; ++i)
+		pthread_join (t[i], NULL);
+}
+
+int pfp_classify (const struct pfp_corpus *c, const char *dir, int workers,
+		  struct pfp_snapshot **set, size_t *count)
+{
+	struct pool pool;
+	struct list list;
+
+	list.set   = NULL;
+	list.count = list.avail = 0;
+
+	if (!pfp_walk (dir, list_walker, &list)) {
+		pfp_snapshot_free (list.set, list.count);
+		return 0;
+	}
+
+	qsort (list.set, list.count, sizeof (list.set[0]), snapshot_cmp);
+
+	pool.corpus = c;
+	pool.set    = list.set;
+	pool.count  = list.count;
+	pool.next   = 0;
+
+	pthread_mutex_init (&pool.lock, NULL);
+	pool_run (&pool, workers);
+	pthread_mutex_destroy (&pool.lock);
+
+	*set   = list.set;
+	*count = list.count;
+	return 1;
+}
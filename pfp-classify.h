@@ -0,0 +1,30 @@
+/*
+ * PCI Finger-Print Snapshot Classifier
+ *
+ * Copyright (c) 2016-2024 Alexei A. Smekalkine <ikle@ikle.ru>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef PFP_CLASSIFY_H
+#define PFP_CLASSIFY_H  1
+
+#include "pfp-corpus.h"
+
+struct pfp_snapshot {
+	char *path;
+	int ok;				/* snapshot parsed and matched */
+	const struct pfp_print *print;	/* best match or NULL */
+	size_t rank;
+};
+
+/*
+ * Match all snapshot files from directory tree against corpus using
+ * a pool of workers, returns set of snapshots sorted by path.
+ */
+int pfp_classify (const struct pfp_corpus *c, const char *dir, int workers,
+		  struct pfp_snapshot **set, size_t *count);
+
+void pfp_snapshot_free (struct pfp_snapshot *o, size_t count);
+
+#endif  /* PFP_CLASSIFY_H */
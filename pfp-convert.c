@@ -1,74 +1,528 @@
 /*
- * Make PCI Finger-Print from lspci -nm output
+ * Make PCI Finger-Print from lspci output
  *
- * Copyright (c) 2020 Alexei A. Smekalkine <ikle@ikle.ru>
+ * Copyright (c) 2020-2024 Alexei A. Smekalkine <ikle@ikle.ru>
  *
  * SPDX-License-Identifier: BSD-2-Clause
  */
 
+#include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-static
-int show (const char *slot, const char *class, const char *intf,
-	  const char *vendor, const char *device,
-	  const char *svendor, const char *sdevice)
+#include "pfp-rule.h"
+
+int verbose;
+
+#define MAX_FIELDS	16
+#define MAX_DEPTH	64
+#define IO_BUFFER	(64 * 1024)
+
+struct link {
+	struct pfp_sbdf slot, parent;
+};
+
+struct level {
+	int col;
+	struct pfp_sbdf bus, bridge;
+};
+
+struct host {
+	char *name;
+	int count;
+
+	struct pfp_rule *head, **tail, *rule;
+
+	struct link *links;
+	size_t nlinks, avail;
+
+	struct level level[MAX_DEPTH];
+	int depth;
+};
+
+static void host_init (struct host *o)
 {
-	if (intf[0] == '0')
-		++intf;
+	o->name  = NULL;
+	o->count = 0;
 
-	printf ("slot\t= %s\n", slot);
-	printf ("class\t= %s.%s\n", class, intf);
+	o->head = NULL;
+	o->tail = &o->head;
+	o->rule = NULL;
 
-	if (vendor[0] != '\0') {
-		printf ("vendor\t= %s\n", vendor);
-		printf ("device\t= %s\n", device);
+	o->links  = NULL;
+	o->nlinks = o->avail = 0;
+
+	o->depth = 0;
+}
+
+static void host_reset (struct host *o, const char *name)
+{
+	char *p;
+
+	free (o->name);
+	o->name = NULL;
+
+	if (name != NULL && (o->name = strdup (name)) != NULL)
+		for (p = o->name; (p = strchr (p, '/')) != NULL; ++p)
+			*p = '_';
+
+	pfp_rule_free (o->head);
+	o->head = NULL;
+	o->tail = &o->head;
+	o->rule = NULL;
+
+	o->nlinks = 0;
+	o->depth  = 0;
+}
+
+static void host_fini (struct host *o)
+{
+	host_reset (o, NULL);
+	free (o->links);
+}
+
+static struct pfp_rule *host_add_rule (struct host *o)
+{
+	struct pfp_rule *rule;
+
+	if ((rule = pfp_rule_alloc ()) == NULL)
+		return NULL;
+
+	rule->interface = 0;
+
+	*o->tail = rule;
+	o->tail  = &rule->next;
+	return o->rule = rule;
+}
+
+static int host_add_link (struct host *o, const struct pfp_sbdf *slot,
+			  const struct pfp_sbdf *parent)
+{
+	const size_t avail = o->avail > 0 ? o->avail * 2 : 64;
+	struct link *p;
+
+	if (o->nlinks >= o->avail) {
+		if ((p = realloc (o->links, sizeof (p[0]) * avail)) == NULL)
+			return 0;
+
+		o->links = p;
+		o->avail = avail;
 	}
 
-	if (svendor[0] != '\0') {
-		printf ("svendor\t= %s\n", svendor);
-		printf ("sdevice\t= %s\n", sdevice);
+	p = o->links + o->nlinks++;
+	p->slot   = *slot;
+	p->parent = *parent;
+	return 1;
+}
+
+static const struct link *host_find_link (struct host *o, struct pfp_sbdf *slot)
+{
+	size_t i;
+
+	for (i = 0; i < o->nlinks; ++i)
+		if (o->links[i].slot.segment  == slot->segment	&&
+		    o->links[i].slot.bus      == slot->bus	&&
+		    o->links[i].slot.device   == slot->device	&&
+		    o->links[i].slot.function == slot->function)
+			return o->links + i;
+
+	return NULL;
+}
+
+/*
+ * Split line into space-separated fields in place. Quoted fields may
+ * contain spaces, quotes are stripped.
+ */
+static int split (char *line, char *field[], int max)
+{
+	char *p = line;
+	int n;
+
+	for (n = 0; n < max; ++n) {
+		p += strspn (p, " \t\n");
+
+		if (*p == '\0')
+			break;
+
+		if (*p == '"') {
+			field[n] = ++p;
+			p += strcspn (p, "\"\n");
+		}
+		else {
+			field[n] = p;
+			p += strcspn (p, " \t\n");
+		}
+
+		if (*p != '\0')
+			*p++ = '\0';
+	}
+
+	return n;
+}
+
+static int get_hex (const char *s, int *to)
+{
+	char *end;
+	long v;
+
+	if (s[0] == '\0')
+		return 0;
+
+	v = strtol (s, &end, 16);
+
+	if (*end != '\0')
+		return 0;
+
+	*to = v;
+	return 1;
+}
+
+static int get_slot (const char *slot, struct pfp_sbdf *o)
+{
+	if (sscanf (slot, "%x:%hhx:%hhx.%hho",
+		    &o->segment, &o->bus, &o->device, &o->function) == 4)
+		return 1;
+
+	o->segment = 0;
+
+	if (sscanf (slot, "%hhx:%hhx.%hho",
+		    &o->bus, &o->device, &o->function) == 3)
+		return 1;
+
+	o->bus = 0;
+	return sscanf (slot, "%hhx.%hho", &o->device, &o->function) == 2;
+}
+
+/*
+ * lspci -nm line: slot, class, vendor, device, options, svendor, sdevice
+ */
+static int scan_machine (struct host *o, char *line)
+{
+	char *f[MAX_FIELDS], *q[5];
+	int n, i, k, class, intf = 0;
+	struct pfp_sbdf slot;
+	struct pfp_rule *rule;
+
+	n = split (line, f, MAX_FIELDS);
+
+	for (i = 1, k = 0; i < n; ++i)
+		if (f[i][0] == '-' && f[i][1] == 'p')
+			get_hex (f[i] + 2, &intf);
+		else if (f[i][0] != '-' && k < 5)
+			q[k++] = f[i];
+
+	if (k < 3 || !get_slot (f[0], &slot) || !get_hex (q[0], &class) ||
+	    (rule = host_add_rule (o)) == NULL)
+		return 0;
+
+	rule->slot      = slot;
+	rule->class     = class;
+	rule->interface = intf;
+
+	get_hex (q[1], &rule->vendor);
+	get_hex (q[2], &rule->device);
+
+	if (k == 5) {
+		get_hex (q[3], &rule->svendor);
+		get_hex (q[4], &rule->sdevice);
 	}
 
 	return 1;
 }
 
-static int scan (const char *line)
+/*
+ * lspci -nmm -v record line: key, colon, tab, value; the value may be
+ * followed by the numeric one in brackets if -nn was used
+ */
+static int scan_record (struct host *o, char *key, char *value)
 {
-	const char *f[] = {
-		"%9s \"%4s\" \"%4s\" \"%4s\" -r%2s -p%2s \"%4s\" \"%4s\"",
-		"%9s \"%4s\" \"%4s\" \"%4s\" -r%2s \"%4s\" \"%4s\"",
-		"%9s \"%4s\" \"%4s\" \"%4s\" -p%2s \"%4s\" \"%4s\"",
-		"%9s \"%4s\" \"%4s\" \"%4s\" \"%4s\" \"%4s\"",
-	};
-	char s[10], c[5], v[5], d[5], r[3], p[3], sv[5], sd[5];
+	char *p;
+	int *id;
+
+	value[strcspn (value, "\n")] = '\0';
 
-	if (sscanf (line, f[0], &s, &c, &v, &d, &r, &p, &sv, &sd) == 8)
-		return show (s, c, p, v, d, sv, sd);
+	if ((p = strrchr (value, '[')) != NULL) {
+		value = p + 1;
+		value[strcspn (value, "]")] = '\0';
+	}
+
+	if (strcmp (key, "Slot") == 0)
+		return host_add_rule (o) != NULL &&
+		       get_slot (value, &o->rule->slot);
+
+	if (o->rule == NULL)
+		return 0;
+
+	if (strcmp (key, "Driver") == 0) {
+		free (o->rule->attr.driver);
+		return (o->rule->attr.driver = strdup (value)) != NULL;
+	}
 
-	if (sscanf (line, f[1], &s, &c, &v, &d, &r, &sv, &sd) == 7)
-		return show (s, c, "00", v, d, sv, sd);
+	if (strcmp (key, "NUMANode") == 0)
+		return sscanf (value, "%d", &o->rule->attr.numa) == 1;
 
-	if (sscanf (line, f[2], &s, &c, &v, &d, &p, &sv, &sd) == 7)
-		return show (s, c, p, v, d, sv, sd);
+	if (strcmp (key, "IOMMUGroup") == 0)
+		return sscanf (value, "%d", &o->rule->attr.iommu) == 1;
 
-	if (sscanf (line, f[3], &s, &c, &v, &d, &sv, &sd) == 6)
-		return show (s, c, "00", v, d, sv, sd);
+	if (strcmp (key, "Class") == 0)
+		id = &o->rule->class;
+	else if (strcmp (key, "ProgIf") == 0)
+		id = &o->rule->interface;
+	else if (strcmp (key, "Vendor") == 0)
+		id = &o->rule->vendor;
+	else if (strcmp (key, "Device") == 0)
+		id = &o->rule->device;
+	else if (strcmp (key, "SVendor") == 0)
+		id = &o->rule->svendor;
+	else if (strcmp (key, "SDevice") == 0)
+		id = &o->rule->sdevice;
+	else
+		return 1;
 
+	return get_hex (value, id);
+}
+
+static struct level *pop_level (struct host *o, int col)
+{
+	while (o->depth > 0 && o->level[o->depth - 1].col >= col)
+		--o->depth;
+
+	return o->depth > 0 ? o->level + o->depth - 1 : NULL;
+}
+
+static void push_level (struct host *o, int col, const struct pfp_sbdf *bus,
+			const struct pfp_sbdf *bridge)
+{
+	struct level *p;
+
+	pop_level (o, col);
+
+	if (o->depth >= MAX_DEPTH)
+		return;
+
+	p = o->level + o->depth++;
+	p->col    = col;
+	p->bus    = *bus;
+	p->bridge = *bridge;
+}
+
+static int is_device (const char *p)
+{
+	return isxdigit (p[0]) && isxdigit (p[1]) && p[2] == '.' &&
+	       p[3] >= '0' && p[3] <= '7';
+}
+
+/*
+ * lspci -t line: root bus is [segment:bus], secondary bus of a bridge
+ * is [bus] or [bus-subordinate], device is dev.fn followed by its name
+ * if any; devices of a bus are placed right of the bus bracket
+ */
+static void scan_tree (struct host *o, char *line)
+{
+	static const struct pfp_sbdf none = { .segment = -1 };
+	struct pfp_sbdf bus, slot;
+	struct level *l;
+	char *p, *end;
+	unsigned long v;
+	int col, last = 0;
+
+	for (p = line; *p != '\0' && *p != '\n';) {
+		col = p - line;
+
+		if (*p == '[') {
+			bus.segment = last ? slot.segment : 0;
+			bus.bus = v = strtoul (p + 1, &end, 16);
+
+			if (*end == ':') {
+				bus.segment = v;
+				bus.bus = strtoul (end + 1, &end, 16);
+				last = 0;
+			}
+
+			push_level (o, col, &bus, last ? &slot : &none);
+
+			if ((p = strchr (end, ']')) == NULL)
+				break;
+
+			last = 0;
+			continue;
+		}
+
+		if (p > line && p[-1] == '-' && is_device (p)) {
+			if ((l = pop_level (o, col)) == NULL)
+				break;
+
+			slot = l->bus;
+			slot.device   = strtoul (p, NULL, 16);
+			slot.function = p[3] - '0';
+
+			host_add_link (o, &slot, &l->bridge);
+			last = 1;
+
+			if (*(p += 4) == ' ')
+				break;  /* device name follows */
+
+			continue;
+		}
+
+		++p;
+	}
+}
+
+static int scan (struct host *o, char *line)
+{
+	size_t len;
+
+	if (line[0] != '\0' && strchr ("-+|\\ ", line[0]) != NULL) {
+		scan_tree (o, line);
+		return 1;
+	}
+
+	len = strspn (line, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz");
+
+	if (len > 0 && line[len] == ':' && line[len + 1] == '\t') {
+		line[len] = '\0';
+		return scan_record (o, line, line + len + 2);
+	}
+
+	return line[0] == '\n' || scan_machine (o, line);
+}
+
+static void host_link (struct host *o)
+{
+	struct pfp_rule *rule;
+	const struct link *l;
+
+	if (o->nlinks == 0)
+		return;
+
+	for (rule = o->head; rule != NULL; rule = rule->next) {
+		if ((l = host_find_link (o, &rule->slot)) != NULL)
+			rule->parent = l->parent;
+
+		if (rule->parent.segment < 0)
+			rule->segment = pfp_root_segment (rule->slot.segment,
+							  rule->slot.bus);
+	}
+
+	pfp_rule_link (o->head);
+}
+
+static int host_write (struct host *o, const char *dir)
+{
+	FILE *to = stdout;
+	char *path;
+	int len, ok;
+
+	if (o->head == NULL)
+		return 1;
+
+	host_link (o);
+
+	if ((o->head = pfp_rule_sort (o->head)) == NULL) {
+		perror ("pfp-convert: sort");
+		return 0;
+	}
+
+	if (dir != NULL && o->name != NULL) {
+		len = snprintf (NULL, 0, "%s/%s.pfp", dir, o->name) + 1;
+
+		if ((path = malloc (len)) == NULL)
+			goto no_path;
+
+		snprintf (path, len, "%s/%s.pfp", dir, o->name);
+
+		if ((to = fopen (path, "w")) == NULL)
+			goto no_open;
+
+		setvbuf (to, NULL, _IOFBF, IO_BUFFER);
+		free (path);
+	}
+	else {
+		if (o->count++ > 0)
+			fputc ('\n', to);
+
+		if (o->name != NULL)
+			fprintf (to, "# %s\n\n", o->name);
+	}
+
+	pfp_rule_show (o->head, to, verbose);
+
+	if (to == stdout)
+		return !ferror (to);
+
+	ok = !ferror (to);
+	return (fclose (to) == 0) && ok;
+no_open:
+	perror (path);
+	free (path);
+	return 0;
+no_path:
+	perror ("pfp-convert");
 	return 0;
 }
 
+static int is_header (const char *line, size_t len)
+{
+	return len > 9 && strncmp (line, "==> ", 4) == 0 &&
+	       strcmp (line + len - 5, " <==\n") == 0;
+}
+
 int main (int argc, char *argv[])
 {
-	int first = 1;
-	char line[64];
+	const char *dir = NULL;
+	struct host h;
+	char *line = NULL;
+	size_t size = 0, n = 0;
+	ssize_t len;
+	int ok = 1;
 
-	while (fgets (line, sizeof (line), stdin) != NULL) {
-		if (!first)
-			printf ("\n");
+	for (; argc > 1 && argv[1][0] == '-'; --argc, ++argv)
+		if (strcmp (argv[1], "-v") == 0)
+			++verbose;
+		else if (strcmp (argv[1], "-o") == 0 && argc > 2) {
+			dir = argv[2];
+			--argc, ++argv;
+		}
+		else
+			goto usage;
 
-		scan (line);
-		first = 0;
+	if (argc > 1)
+		goto usage;
+
+	setvbuf (stdin,  NULL, _IOFBF, IO_BUFFER);
+	setvbuf (stdout, NULL, _IOFBF, IO_BUFFER);
+
+	host_init (&h);
+
+	while ((len = getline (&line, &size, stdin)) > 0) {
+		++n;
+
+		if (!is_header (line, len)) {
+			if (!scan (&h, line)) {
+				fprintf (stderr, "pfp-convert: line %zu: "
+						 "malformed lspci output\n", n);
+				ok = 0;
+			}
+
+			continue;
+		}
+
+		ok &= host_write (&h, dir);
+
+		line[len - 5] = '\0';
+		host_reset (&h, line + 4);
 	}
 
-	return 0;
+	ok &= host_write (&h, dir);
+
+	host_fini (&h);
+	free (line);
+	return ok ? 0 : 1;
+usage:
+	fprintf (stderr, "usage:\n"
+			 "\tpfp-convert [-v] < lspci-output > out\n"
+			 "\tpfp-convert [-v] -o directory < lspci-dumps\n");
+	return 1;
 }
@@ -0,0 +1,708 @@
+/*
+ * PCI Finger-Print Corpus
+ *
+ * Copyright (c) 2016-2024 Alexei A. Smekalkine <ikle@ikle.ru>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+
+#include "pfp-assign.h"
+#include "pfp-corpus.h"
+#include "pfp-format.h"
+#include "pfp-walk.h"
+
+static struct pfp_rule *load_bin (FILE *from)
+{
+	struct pfp_buf b;
+	char chunk[BUFSIZ];
+	size_t len;
+	struct pfp_rule *r = NULL;
+
+	pfp_buf_init (&b);
+
+	while ((len = fread (chunk, 1, sizeof (chunk), from)) > 0)
+		if (!pfp_buf_write (&b, chunk, len))
+			goto no_read;
+
+	if (!ferror (from))
+		r = pfp_format_load (b.data, b.len);
+no_read:
+	pfp_buf_fini (&b);
+	return r;
+}
+
+struct pfp_rule *pfp_load (struct pfp_parser *p, FILE *from)
+{
+	int c;
+
+	if (p != NULL)
+		pfp_parser_reset (p, from);
+
+	if ((c = getc (from)) != EOF)
+		ungetc (c, from);
+
+	if (c == PFP_FORMAT_BIN_MAGIC)
+		return load_bin (from);
+
+	return p == NULL ? pfp_parse (from) : pfp_parser_run (p);
+}
+
+void pfp_corpus_init (struct pfp_corpus *o)
+{
+	o->set   = NULL;
+	o->count = o->avail = 0;
+	o->block = NULL;
+	o->block_count = o->block_avail = 0;
+	o->cache = NULL;
+	o->error = NULL;
+}
+
+void pfp_corpus_fini (struct pfp_corpus *o)
+{
+	size_t i;
+
+	for (i = 0; i < o->count; ++i) {
+		free (o->set[i].name);
+		pfp_rule_free (o->set[i].rules);
+		free (o->set[i].include);
+	}
+
+	for (i = 0; i < o->block_count; ++i) {
+		free (o->block[i].path);
+		pfp_rule_free (o->block[i].rules);
+	}
+
+	free (o->set);
+	free (o->block);
+	free (o->error);
+}
+
+static void set_error (struct pfp_corpus *o, const char *path, int line,
+		       const char *reason)
+{
+	const size_t len = strlen (path) + strlen (reason) + 16;
+	const int e = errno;
+
+	free (o->error);
+
+	if ((o->error = malloc (len)) != NULL) {
+		if (line > 0)
+			snprintf (o->error, len, "%s:%d: %s", path, line, reason);
+		else
+			snprintf (o->error, len, "%s: %s", path, reason);
+	}
+
+	errno = e;
+}
+
+/* record parse failure reason if any */
+static int load_error (struct pfp_corpus *o, struct pfp_parser *parser,
+		       const char *path)
+{
+	const char *reason;
+	int line;
+
+	if ((reason = pfp_parser_error (parser, &line)) == NULL)
+		return 0;
+
+	set_error (o, path, line, reason);
+	errno = EINVAL;
+	return 1;
+}
+
+/*
+ * Load rules from cache if not changed or from file otherwise, parser
+ * is optional and may be passed to be reused, a temporary one is used
+ * otherwise to tell parse failure from empty file
+ */
+static int load_file (struct pfp_corpus *o, struct pfp_parser *parser,
+		      const char *path, const struct stat *st,
+		      struct pfp_rule **rules)
+{
+	struct pfp_parser *own = NULL;
+	FILE *f;
+	int ok = 0;
+
+	if (o->cache != NULL && pfp_cache_get (o->cache, path, st, rules))
+		return 1;
+
+	if (parser == NULL && (parser = own = pfp_parser_alloc (NULL)) == NULL) {
+		set_error (o, path, 0, strerror (errno));
+		return 0;
+	}
+
+	if ((f = fopen (path, "r")) == NULL) {
+		set_error (o, path, 0, strerror (errno));
+		goto no_open;
+	}
+
+	*rules = pfp_load (parser, f);
+	fclose (f);
+
+	if (*rules == NULL && load_error (o, parser, path))
+		goto no_load;
+
+	if (o->cache != NULL)
+		pfp_cache_put (o->cache, path, st, *rules);
+
+	ok = 1;
+no_load:
+no_open:
+	pfp_parser_free (own);
+	return ok;
+}
+
+static int add_block (struct pfp_corpus *o, const char *path,
+		      const struct stat *st, struct pfp_rule *rules)
+{
+	const size_t avail = o->block_avail > 0 ? o->block_avail * 2 : 16;
+	struct pfp_block *p;
+	const struct pfp_rule *r;
+
+	for (r = rules; r != NULL; r = r->next)
+		if (r->include != NULL) {
+			set_error (o, path, 0, "nested include");
+			errno = EINVAL;
+			goto no_set;
+		}
+
+	if (o->block_count >= o->block_avail) {
+		if ((p = realloc (o->block, sizeof (p[0]) * avail)) == NULL)
+			goto no_set;
+
+		o->block       = p;
+		o->block_avail = avail;
+	}
+
+	p = o->block + o->block_count;
+
+	if ((p->path = strdup (path)) == NULL)
+		goto no_set;
+
+	p->dev   = st != NULL ? st->st_dev : 0;
+	p->ino   = st != NULL ? st->st_ino : 0;
+	p->rules = rules;
+	p->count = pfp_rule_count (rules);
+
+	++o->block_count;
+	return 1;
+no_set:
+	pfp_rule_free (rules);
+	return 0;
+}
+
+int pfp_corpus_add_block (struct pfp_corpus *o, const char *path,
+			  struct pfp_rule *rules)
+{
+	struct stat st;
+
+	return add_block (o, path, stat (path, &st) == 0 ? &st : NULL, rules);
+}
+
+/* include name is relative to the directory of including file */
+static char *include_path (const char *name, const char *include)
+{
+	const char *p = strrchr (name, '/');
+	const int len = include[0] == '/' || p == NULL ? 0 : p - name + 1;
+	const size_t size = len + strlen (include) + 1;
+	char *path;
+
+	if ((path = malloc (size)) != NULL)
+		snprintf (path, size, "%.*s%s", len, name, include);
+
+	return path;
+}
+
+/*
+ * Block is the same file if its device and inode are the same, thus
+ * different names of one file (dir/../x.pfi, links) share the block.
+ * Names are compared for blocks without a file (built-in ones).
+ */
+static int find_block (const struct pfp_corpus *o, const char *path,
+		       const struct stat *st, size_t *index)
+{
+	const struct pfp_block *b;
+	size_t i;
+
+	for (i = 0; i < o->block_count; ++i) {
+		b = o->block + i;
+
+		if ((st != NULL && b->ino != 0 &&
+		     b->dev == st->st_dev && b->ino == st->st_ino) ||
+		    strcmp (b->path, path) == 0) {
+			*index = i;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* find block by file, load it on first use */
+static int get_block (struct pfp_corpus *o, struct pfp_parser *parser,
+		      const char *path, size_t *index)
+{
+	struct stat st;
+	struct pfp_rule *rules;
+
+	if (stat (path, &st) != 0) {
+		if (find_block (o, path, NULL, index))
+			return 1;
+
+		set_error (o, path, 0, strerror (errno));
+		return 0;
+	}
+
+	if (find_block (o, path, &st, index))
+		return 1;
+
+	if (!load_file (o, parser, path, &st, &rules))
+		return 0;
+
+	*index = o->block_count;
+	return add_block (o, path, &st, rules);
+}
+
+/* own rules first, then included blocks */
+static const struct pfp_rule *
+print_list (const struct pfp_corpus *o, const struct pfp_print *p, size_t i)
+{
+	return i == 0 ? p->rules : o->block[p->include[i - 1]].rules;
+}
+
+static int lists_separate (const struct pfp_corpus *o,
+			   const struct pfp_print *p)
+{
+	const struct pfp_rule *a, *b;
+	size_t i, j;
+
+	for (i = 0; i < p->include_count; ++i)
+		for (j = i + 1; j <= p->include_count; ++j)
+			for (a = print_list (o, p, i); a != NULL; a = a->next)
+				for (b = print_list (o, p, j); b != NULL;
+				     b = b->next)
+					if (pfp_rule_overlap (a, b))
+						return 0;
+
+	return 1;
+}
+
+static int resolve (struct pfp_corpus *o, struct pfp_parser *parser,
+		    struct pfp_print *p)
+{
+	const struct pfp_rule *r;
+	size_t n = 0;
+	char *path;
+	int ok;
+
+	for (r = p->rules; r != NULL; r = r->next)
+		n += r->include != NULL;
+
+	if (n > 0 && (p->include = malloc (sizeof (p->include[0]) * n)) == NULL)
+		return 0;
+
+	for (r = p->rules; r != NULL; r = r->next) {
+		if (r->include == NULL) {
+			++p->count;
+			continue;
+		}
+
+		if ((path = include_path (p->name, r->include)) == NULL)
+			return 0;
+
+		ok = get_block (o, parser, path, p->include + p->include_count);
+		free (path);
+
+		if (!ok)
+			return 0;
+
+		p->count += o->block[p->include[p->include_count++]].count;
+	}
+
+	p->separate = lists_separate (o, p);
+	return 1;
+}
+
+static int add_print (struct pfp_corpus *o, struct pfp_parser *parser,
+		      const char *name, struct pfp_rule *rules)
+{
+	const size_t avail = o->avail > 0 ? o->avail * 2 : 64;
+	struct pfp_print *p;
+
+	if (o->count >= o->avail) {
+		if ((p = realloc (o->set, sizeof (p[0]) * avail)) == NULL)
+			goto no_set;
+
+		o->set   = p;
+		o->avail = avail;
+	}
+
+	p = o->set + o->count;
+
+	if ((p->name = strdup (name)) == NULL)
+		goto no_set;
+
+	p->rules   = rules;
+	p->count   = 0;
+	p->include = NULL;
+	p->include_count = 0;
+	p->separate = 1;
+
+	if (!resolve (o, parser, p))
+		goto no_resolve;
+
+	++o->count;
+	return 1;
+no_resolve:
+	free (p->include);
+	free (p->name);
+no_set:
+	pfp_rule_free (rules);
+	return 0;
+}
+
+int pfp_corpus_add (struct pfp_corpus *o, const char *name,
+		    struct pfp_rule *rules)
+{
+	return add_print (o, NULL, name, rules);
+}
+
+struct load {
+	struct pfp_corpus *corpus;
+	struct pfp_parser *parser;
+};
+
+static int load_walker (const char *path, const struct stat *sb, void *cookie)
+{
+	struct load *o = cookie;
+	const char *dot;
+	struct pfp_rule *rules;
+
+	if ((dot = strrchr (path, '.')) == NULL || strcmp (dot, ".pfp") != 0)
+		return 1;
+
+	if (!load_file (o->corpus, o->parser, path, sb, &rules))
+		return 0;
+
+	return add_print (o->corpus, o->parser, path, rules);
+}
+
+int pfp_corpus_load (struct pfp_corpus *o, const char *dir)
+{
+	struct load l = { o, NULL };
+	int ok;
+
+	if ((l.parser = pfp_parser_alloc (NULL)) == NULL)
+		return 0;
+
+	ok = pfp_walk (dir, load_walker, &l);
+
+	pfp_parser_free (l.parser);
+	return ok;
+}
+
+size_t *pfp_corpus_memo (const struct pfp_corpus *o)
+{
+	size_t *memo, i;
+
+	if ((memo = malloc (sizeof (memo[0]) * (o->block_count + 1))) == NULL)
+		return NULL;
+
+	for (i = 0; i < o->block_count; ++i)
+		memo[i] = (size_t) -1;
+
+	return memo;
+}
+
+static int print_assign (const struct pfp_corpus *o, const struct pfp_print *p,
+			 const struct pfp_index *index, size_t *rank)
+{
+	const struct pfp_rule **lists;
+	size_t i;
+	int ok;
+
+	lists = malloc (sizeof (lists[0]) * (p->include_count + 1));
+
+	if (lists == NULL)
+		return 0;
+
+	for (i = 0; i <= p->include_count; ++i)
+		lists[i] = print_list (o, p, i);
+
+	ok = pfp_assign (index, lists, p->include_count + 1, rank);
+	free (lists);
+	return ok;
+}
+
+/* rules of lists compete for devices unless separate, then all at once */
+int pfp_print_match (const struct pfp_corpus *o, const struct pfp_print *p,
+		     const struct pfp_index *index, size_t *memo, size_t *rank)
+{
+	const struct pfp_rule *rules = p->rules;
+	size_t i, b, n;
+
+	if (!p->separate)
+		return print_assign (o, p, index, rank);
+
+	if (!pfp_assign (index, &rules, 1, rank))
+		return 0;
+
+	for (i = 0; i < p->include_count; ++i) {
+		b = p->include[i];
+
+		if (memo != NULL && memo[b] != (size_t) -1) {
+			*rank += memo[b];
+			continue;
+		}
+
+		rules = o->block[b].rules;
+
+		if (!pfp_assign (index, &rules, 1, &n))
+			return 0;
+
+		if (memo != NULL)
+			memo[b] = n;
+
+		*rank += n;
+	}
+
+	return 1;
+}
+
+int pfp_corpus_match (const struct pfp_corpus *o, const struct pfp_rule *scan,
+		      const struct pfp_print **best, size_t *rank)
+{
+	const struct pfp_print *p;
+	struct pfp_index index;
+	size_t *memo, i, r;
+	int ok = 1;
+
+	*best = NULL;
+	*rank = 0;
+
+	if (!pfp_index_init (&index, scan))
+		return 0;
+
+	memo = pfp_corpus_memo (o);
+
+	for (i = 0; i < o->count; ++i) {
+		p = o->set + i;
+
+		if (!(ok = pfp_print_match (o, p, &index, memo, &r)))
+			break;
+
+		if (r == p->count && *rank < r) {
+			*rank = r;
+			*best = p;
+		}
+	}
+
+	free (memo);
+	pfp_index_fini (&index);
+	return ok;
+}
+
+/* positive if a is better: higher score, higher rank, loaded earlier */
+static int score_cmp (const struct pfp_score *a, const struct pfp_score *b)
+{
+	const size_t x = a->rank * b->total, y = b->rank * a->total;
+
+	if (x != y)
+		return x > y ? 1 : -1;
+
+	if (a->rank != b->rank)
+		return a->rank > b->rank ? 1 : -1;
+
+	return a->print < b->print ? 1 : a->print > b->print ? -1 : 0;
+}
+
+static int score_order (const void *a, const void *b)
+{
+	return score_cmp (b, a);
+}
+
+/* bounded heap with the worst score on top */
+struct heap {
+	struct pfp_score *set;
+	size_t count, size;
+};
+
+static void heap_swap (struct heap *o, size_t i, size_t j)
+{
+	const struct pfp_score t = o->set[i];
+
+	o->set[i] = o->set[j];
+	o->set[j] = t;
+}
+
+static void heap_push (struct heap *o, const struct pfp_score *s)
+{
+	size_t i, j, up;
+
+	if (o->count < o->size) {
+		for (i = o->count++, o->set[i] = *s; i > 0; i = up) {
+			up = (i - 1) / 2;
+
+			if (score_cmp (o->set + up, o->set + i) <= 0)
+				break;
+
+			heap_swap (o, i, up);
+		}
+
+		return;
+	}
+
+	for (i = 0, o->set[0] = *s; (j = 2 * i + 1) < o->count; i = j) {
+		if (j + 1 < o->count &&
+		    score_cmp (o->set + j + 1, o->set + j) < 0)
+			++j;
+
+		if (score_cmp (o->set + i, o->set + j) <= 0)
+			break;
+
+		heap_swap (o, i, j);
+	}
+}
+
+/* score of the best case: all the rest of rules will match */
+static void score_bound (struct pfp_score *s, const struct pfp_print *p,
+			 size_t hits, size_t done, size_t devices)
+{
+	s->print = p;
+	s->rank  = hits + (p->count - done);
+	s->total = p->count + devices - s->rank;
+}
+
+static size_t block_hits (const struct pfp_block *b,
+			  const struct pfp_index *index)
+{
+	const struct pfp_rule *r;
+	size_t hits = 0;
+
+	for (r = b->rules; r != NULL; r = r->next)
+		hits += pfp_index_match (index, r, NULL, NULL) > 0;
+
+	return hits;
+}
+
+struct rank {
+	const struct pfp_corpus *corpus;
+	struct pfp_index index;
+	struct heap heap;
+	size_t *memo;  /* matched rules of blocks */
+};
+
+/*
+ * Rules of finger-print are looked up in index of scan one by one, the
+ * scoring is stopped as soon as even the best case of the rest of rules
+ * cannot beat the worst of k best scores found so far. Included blocks
+ * are scored once per scan. Number of rules with any matching device
+ * bounds the assignment, devices are assigned to the rules only if the
+ * bound passes. Returns -1 on failure.
+ */
+static int score_print (struct rank *o, const struct pfp_print *p,
+			struct pfp_score *s)
+{
+	const int full = o->heap.count == o->heap.size;
+	const size_t devices = o->index.count;
+	const struct pfp_rule *r;
+	const struct pfp_block *b;
+	size_t hits = 0, done = 0, i, j;
+
+	for (r = p->rules; r != NULL; r = r->next) {
+		if (r->include != NULL)
+			continue;
+
+		score_bound (s, p, hits, done++, devices);
+
+		if (full && score_cmp (s, o->heap.set) <= 0)
+			return 0;
+
+		hits += pfp_index_match (&o->index, r, NULL, NULL) > 0;
+	}
+
+	for (i = 0; i < p->include_count; ++i) {
+		score_bound (s, p, hits, done, devices);
+
+		if (full && score_cmp (s, o->heap.set) <= 0)
+			return 0;
+
+		j = p->include[i];
+		b = o->corpus->block + j;
+
+		if (o->memo[j] == (size_t) -1)
+			o->memo[j] = block_hits (b, &o->index);
+
+		hits += o->memo[j];
+		done += b->count;
+	}
+
+	score_bound (s, p, hits, done, devices);
+
+	if (full && score_cmp (s, o->heap.set) <= 0)
+		return 0;
+
+	if (!print_assign (o->corpus, p, &o->index, &hits))
+		return -1;
+
+	score_bound (s, p, hits, p->count, devices);
+
+	if (s->total == 0)  /* empty finger-print for empty system */
+		s->total = 1;
+
+	return !full || score_cmp (s, o->heap.set) > 0;
+}
+
+int pfp_corpus_rank (const struct pfp_corpus *o, const struct pfp_rule *scan,
+		     struct pfp_score *top, size_t *count)
+{
+	struct rank r;
+	struct pfp_score s;
+	size_t i;
+	int ok = 0;
+
+	if (*count == 0)
+		return 1;
+
+	r.corpus = o;
+
+	if ((r.memo = pfp_corpus_memo (o)) == NULL)
+		return 0;
+
+	if (!pfp_index_init (&r.index, scan)) {
+		free (r.memo);
+		return 0;
+	}
+
+	r.heap.set   = top;
+	r.heap.count = 0;
+	r.heap.size  = *count;
+
+	for (i = 0; i < o->count; ++i) {
+		if (o->set[i].count == 0)
+			continue;
+
+		if ((ok = score_print (&r, o->set + i, &s)) < 0)
+			break;
+
+		if (ok)
+			heap_push (&r.heap, &s);
+	}
+
+	pfp_index_fini (&r.index);
+	free (r.memo);
+
+	if (ok < 0)
+		return 0;
+
+	qsort (top, r.heap.count, sizeof (top[0]), score_order);
+	*count = r.heap.count;
+	return 1;
+}
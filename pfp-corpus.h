@@ -0,0 +1,111 @@
+/*
+ * PCI Finger-Print Corpus
+ *
+ * Copyright (c) 2016-2024 Alexei A. Smekalkine <ikle@ikle.ru>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef PFP_CORPUS_H
+#define PFP_CORPUS_H  1
+
+#include <sys/types.h>
+
+#include "pfp-cache.h"
+#include "pfp-index.h"
+#include "pfp-parser.h"
+
+/*
+ * Shared rule block (*.pfi) referenced by include rules of finger-prints
+ * is loaded and kept once per corpus
+ */
+struct pfp_block {
+	char *path;
+	struct pfp_rule *rules;
+	size_t count;
+	dev_t dev;		/* file identity, zero if unknown */
+	ino_t ino;
+};
+
+struct pfp_print {
+	char *name;
+	struct pfp_rule *rules;
+	size_t count;		/* own and included rules */
+	size_t *include;	/* indices of included blocks */
+	size_t include_count;
+	int separate;		/* no device may match rules of two lists */
+};
+
+struct pfp_corpus {
+	struct pfp_print *set;
+	size_t count, avail;
+	struct pfp_block *block;
+	size_t block_count, block_avail;
+	struct pfp_cache *cache;  /* optional parsed rules cache */
+	char *error;  /* "path:line: reason" of last load failure */
+};
+
+/*
+ * Load rule list from text or binary form, the parser is optional and
+ * may be passed to be reused
+ */
+struct pfp_rule *pfp_load (struct pfp_parser *p, FILE *from);
+
+void pfp_corpus_init (struct pfp_corpus *o);
+void pfp_corpus_fini (struct pfp_corpus *o);
+
+/*
+ * Add finger-print, corpus takes ownership of rules. Include file names
+ * are relative to the directory of finger-print name, blocks are loaded
+ * on first use unless added before.
+ */
+int pfp_corpus_add (struct pfp_corpus *o, const char *name,
+		    struct pfp_rule *rules);
+
+int pfp_corpus_add_block (struct pfp_corpus *o, const char *path,
+			  struct pfp_rule *rules);
+
+/* load all finger-print files (*.pfp) from directory tree */
+int pfp_corpus_load (struct pfp_corpus *o, const char *dir);
+
+/*
+ * Devices are assigned to own and included rules of finger-print one to
+ * one. If no device may match rules of two different lists (own rules
+ * and blocks) they are assigned list by list, then match result of a
+ * block is the same for all finger-prints including it, memo keeps
+ * results for one scan. It is allocated with pfp_corpus_memo (NULL on
+ * failure, matching works without memo as well) and freed with free.
+ * Scan is passed as its index, built once per scan as well. Rank is set
+ * to number of matches. Returns zero with errno set on failure.
+ */
+size_t *pfp_corpus_memo (const struct pfp_corpus *o);
+
+int pfp_print_match (const struct pfp_corpus *o, const struct pfp_print *p,
+		     const struct pfp_index *index, size_t *memo, size_t *rank);
+
+/*
+ * Find finger-print fully matched with highest rank, best is set to NULL
+ * if there is none. Returns zero with errno set on failure.
+ */
+int pfp_corpus_match (const struct pfp_corpus *o, const struct pfp_rule *scan,
+		      const struct pfp_print **best, size_t *rank);
+
+/*
+ * Score of partial match is rank (number of pattern rules matched) to
+ * total (number of pattern rules and unmatched devices), thus missed and
+ * extra devices both lower it.
+ */
+struct pfp_score {
+	const struct pfp_print *print;
+	size_t rank, total;
+};
+
+/*
+ * Find up to *count finger-prints with the best scores, sorted best
+ * first, *count is set to the number found. Returns zero with errno set
+ * on failure.
+ */
+int pfp_corpus_rank (const struct pfp_corpus *o, const struct pfp_rule *scan,
+		     struct pfp_score *top, size_t *count);
+
+#endif  /* PFP_CORPUS_H */
@@ -0,0 +1,143 @@
+/*
+ * PCI Finger-Print Difference
+ *
+ * Copyright (c) 2016-2024 Alexei A. Smekalkine <ikle@ikle.ru>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdlib.h>
+
+#include "pfp-assign.h"
+#include "pfp-diff.h"
+
+struct diff {
+	struct pfp_buf *out;
+	size_t *hits;
+	long count;
+	int verbose, ok;
+};
+
+static void count_hit (const struct pfp_rule *o, size_t index, void *cookie)
+{
+	struct diff *d = cookie;
+
+	++d->hits[index];
+}
+
+static int show_where (struct pfp_buf *o, const struct pfp_rule *r)
+{
+	const struct pfp_sbdf *s = &r->slot;
+
+	if (r->path != NULL)
+		return pfp_buf_printf (o, " %s", r->path);
+
+	return pfp_buf_printf (o, " %04x:%02x:%02x.%x",
+			       s->segment, s->bus, s->device, s->function);
+}
+
+static void list_hit (const struct pfp_rule *o, size_t index, void *cookie)
+{
+	struct diff *d = cookie;
+
+	d->ok &= show_where (d->out, o);
+}
+
+static void report (struct diff *d, const char *what)
+{
+	if (d->count++ > 0)
+		d->ok &= pfp_buf_write (d->out, "\n", 1);
+
+	d->ok &= pfp_buf_printf (d->out, "# %s", what);
+}
+
+static void report_rule (struct diff *d, const struct pfp_rule *r)
+{
+	d->ok &= pfp_buf_write (d->out, "\n", 1) &&
+		 pfp_format_rule (d->out, r, d->verbose);
+}
+
+/*
+ * Devices are assigned to pattern rules one to one as pfp match does,
+ * only rules and devices left unassigned are reported. Those with no
+ * match at all are missing or unexpected, the rest are ambiguous: they
+ * lost their candidates to other rules or devices.
+ */
+long pfp_diff (const struct pfp_rule *scan, const struct pfp_rule *pattern,
+	       struct pfp_buf *out, int verbose)
+{
+	struct pfp_index index;
+	struct diff d = { out, NULL, 0, verbose, 1 };
+	const struct pfp_rule *p;
+	size_t *match, *used, i, n, rank;
+
+	if (!pfp_index_init (&index, scan))
+		return -1;
+
+	for (n = 0, p = pattern; p != NULL; p = p->next)
+		n += p->include == NULL;
+
+	if ((d.hits = calloc (index.count + 1, sizeof (d.hits[0]))) == NULL)
+		goto no_hits;
+
+	if ((match = malloc (sizeof (match[0]) * (index.count + 1))) == NULL)
+		goto no_match;
+
+	if ((used = calloc (n + 1, sizeof (used[0]))) == NULL)
+		goto no_used;
+
+	if (!pfp_assign_map (&index, &pattern, 1, match, &rank))
+		goto no_assign;
+
+	for (i = 0; i < index.count; ++i)
+		if (match[i] != (size_t) -1)
+			used[match[i]] = 1;
+
+	for (i = 0, p = pattern; p != NULL; p = p->next) {
+		if (p->include != NULL)  /* resolved by corpus only */
+			continue;
+
+		n = pfp_index_match (&index, p, count_hit, &d);
+
+		if (used[i++])
+			continue;
+
+		if (n == 0)
+			report (&d, "missing");
+		else {
+			report (&d, "ambiguous, matches");
+			pfp_index_match (&index, p, list_hit, &d);
+		}
+
+		report_rule (&d, p);
+	}
+
+	for (i = 0, p = scan; p != NULL; ++i, p = p->next) {
+		if (match[i] != (size_t) -1)
+			continue;
+
+		if (d.hits[i] == 0)
+			report (&d, "unexpected");
+		else {
+			report (&d, "ambiguous, matched by");
+			d.ok &= pfp_buf_printf (out, " %zu rules", d.hits[i]);
+		}
+
+		report_rule (&d, p);
+	}
+
+	free (used);
+	free (match);
+	free (d.hits);
+	pfp_index_fini (&index);
+	return d.ok ? d.count : -1;
+no_assign:
+	free (used);
+no_used:
+	free (match);
+no_match:
+	free (d.hits);
+no_hits:
+	pfp_index_fini (&index);
+	return -1;
+}
@@ -0,0 +1,25 @@
+/*
+ * PCI Finger-Print Difference
+ *
+ * Copyright (c) 2016-2024 Alexei A. Smekalkine <ikle@ikle.ru>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef PFP_DIFF_H
+#define PFP_DIFF_H  1
+
+#include "pfp-format.h"
+
+/*
+ * Compare device list with pattern and append report of missing pattern
+ * rules, unexpected devices and ambiguous matches into buffer. Devices
+ * are assigned to rules one to one, as with pfp_rule_match, and only
+ * rules and devices left unassigned are reported. Returns number of
+ * differences found or -1 on error. Rules are shown as with
+ * pfp_format_rule.
+ */
+long pfp_diff (const struct pfp_rule *scan, const struct pfp_rule *pattern,
+	       struct pfp_buf *out, int verbose);
+
+#endif  /* PFP_DIFF_H */
@@ -0,0 +1,291 @@
+/*
+ * Compile PCI Finger-Print Corpus into C Tables
+ *
+ * Copyright (c) 2016-2024 Alexei A. Smekalkine <ikle@ikle.ru>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pfp-corpus.h"
+
+static void put_string (FILE *to, const char *s)
+{
+	if (s == NULL) {
+		fputs ("NULL", to);
+		return;
+	}
+
+	putc ('"', to);
+
+	for (; *s != '\0'; ++s)
+		if (*s == '"' || *s == '\\')
+			fprintf (to, "\\%c", *s);
+		else if (isprint ((unsigned char) *s))
+			putc (*s, to);
+		else
+			fprintf (to, "\\%03o", (unsigned char) *s);
+
+	putc ('"', to);
+}
+
+static void put_sbdf (FILE *to, const struct pfp_sbdf *o)
+{
+	fprintf (to, "{ %d, %u, %u, %u }",
+		 o->segment, o->bus, o->device, o->function);
+}
+
+/* identifiers in hex as in finger-print files, -1 for absent one */
+static void put_id (FILE *to, const char *field, int x)
+{
+	if (x < 0)
+		fprintf (to, "\t\t.%-9s = %d,\n", field, x);
+	else
+		fprintf (to, "\t\t.%-9s = 0x%04x,\n", field, x);
+}
+
+static void put_rule (FILE *to, const struct pfp_rule *r)
+{
+	const struct pfp_wild *w = &r->wild;
+
+	fputs ("\t\t.path      = ", to);
+	put_string (to, r->path);
+	fprintf (to, ",\n\t\t.segment   = %d,\n", r->segment);
+	fputs ("\t\t.parent    = ", to);
+	put_sbdf (to, &r->parent);
+	fputs (",\n\t\t.slot      = ", to);
+	put_sbdf (to, &r->slot);
+	fputs (",\n", to);
+	put_id (to, "class",     r->class);
+	put_id (to, "interface", r->interface);
+	put_id (to, "vendor",    r->vendor);
+	put_id (to, "device",    r->device);
+	put_id (to, "svendor",   r->svendor);
+	put_id (to, "sdevice",   r->sdevice);
+	fprintf (to, "\t\t.wild      = "
+		     "{ 0x%x, 0x%x, 0x%x, 0x%x, 0x%x, 0x%x },\n",
+		 w->class, w->interface, w->vendor, w->device,
+		 w->svendor, w->sdevice);
+	fputs ("\t\t.name      = ", to);
+	put_string (to, r->name);
+	fputs (",\n\t\t.attr      = { ", to);
+	put_string (to, r->attr.driver);
+	fputs (", ", to);
+	put_string (to, r->attr.speed);
+	fprintf (to, ", %d, %d, %d },\n",
+		 r->attr.numa, r->attr.iommu, r->attr.width);
+	fputs ("\t\t.include   = ", to);
+	put_string (to, r->include);
+	fputs (",\n", to);
+}
+
+/*
+ * Rules are kept as an array linked in order. All the tables are
+ * constant, casts only satisfy pointer field types: the built-in corpus
+ * is never modified.
+ */
+static void put_rules (FILE *to, const char *table, size_t i,
+		       const struct pfp_rule *r)
+{
+	size_t n;
+
+	if (r == NULL)
+		return;
+
+	fprintf (to, "static const struct pfp_rule %s_%zu[] = {\n", table, i);
+
+	for (n = 1; r != NULL; r = r->next, ++n) {
+		fputs ("\t{\n", to);
+
+		if (r->next != NULL)
+			fprintf (to, "\t\t.next      = RULE (%s_%zu + %zu),\n",
+				 table, i, n);
+
+		put_rule (to, r);
+		fputs ("\t},\n", to);
+	}
+
+	fputs ("};\n\n", to);
+}
+
+static void put_table (FILE *to, const char *type, const char *table,
+		       size_t i, int present)
+{
+	if (present)
+		fprintf (to, "%s (%s_%zu)", type, table, i);
+	else
+		fputs ("NULL", to);
+}
+
+static const struct pfp_corpus *sort_corpus;
+
+static int block_cmp (const void *a, const void *b)
+{
+	const size_t *p = a, *q = b;
+
+	return strcmp (sort_corpus->block[*p].path,
+		       sort_corpus->block[*q].path);
+}
+
+static int print_cmp (const void *a, const void *b)
+{
+	const struct pfp_print *p = a, *q = b;
+
+	return strcmp (p->name, q->name);
+}
+
+/*
+ * Finger-prints and blocks are ordered by name and rules of each one by
+ * path, thus the output does not depend on directory walk order.
+ * Includes are resolved already: finger-print refers to blocks by index
+ * and its rule count covers included rules.
+ */
+static int put_corpus (FILE *to, struct pfp_corpus *c)
+{
+	size_t *order, *pos, i, j;
+	struct pfp_print *p;
+	struct pfp_block *b;
+
+	if ((order = malloc (sizeof (order[0]) * (c->block_count * 2 + 1)))
+	    == NULL)
+		return 0;
+
+	pos = order + c->block_count;
+
+	for (i = 0; i < c->block_count; ++i)
+		order[i] = i;
+
+	sort_corpus = c;
+	qsort (order, c->block_count, sizeof (order[0]), block_cmp);
+	qsort (c->set, c->count, sizeof (c->set[0]), print_cmp);
+
+	for (i = 0; i < c->block_count; ++i)
+		pos[order[i]] = i;
+
+	fprintf (to, "/* generated by pfp-embed, do not edit */\n\n"
+		     "#include \"pfp-builtin.h\"\n\n"
+		     "#define RULE(p)   ((struct pfp_rule *) (p))\n"
+		     "#define INDEX(p)  ((size_t *) (p))\n\n");
+
+	for (i = 0; i < c->block_count; ++i) {
+		b = c->block + order[i];
+
+		if (b->rules != NULL &&
+		    (b->rules = pfp_rule_sort (b->rules)) == NULL)
+			goto no_sort;
+
+		put_rules (to, "block", i, b->rules);
+	}
+
+	for (i = 0; i < c->count; ++i) {
+		p = c->set + i;
+
+		if (p->rules != NULL &&
+		    (p->rules = pfp_rule_sort (p->rules)) == NULL)
+			goto no_sort;
+
+		put_rules (to, "print", i, p->rules);
+
+		if (p->include_count == 0)
+			continue;
+
+		fprintf (to, "static const size_t include_%zu[] = {", i);
+
+		for (j = 0; j < p->include_count; ++j)
+			fprintf (to, " %zu,", pos[p->include[j]]);
+
+		fputs (" };\n\n", to);
+	}
+
+	if (c->block_count > 0) {
+		fputs ("static const struct pfp_block block[] = {\n", to);
+
+		for (i = 0; i < c->block_count; ++i) {
+			b = c->block + order[i];
+			fputs ("\t{ ", to);
+			put_string (to, b->path);
+			fputs (", ", to);
+			put_table (to, "RULE", "block", i, b->rules != NULL);
+			fprintf (to, ", %zu, 0, 0 },\n", b->count);
+		}
+
+		fputs ("};\n\n", to);
+	}
+
+	if (c->count > 0) {
+		fputs ("static const struct pfp_print print[] = {\n", to);
+
+		for (i = 0; i < c->count; ++i) {
+			p = c->set + i;
+			fputs ("\t{ ", to);
+			put_string (to, p->name);
+			fputs (", ", to);
+			put_table (to, "RULE", "print", i, p->rules != NULL);
+			fprintf (to, ", %zu, ", p->count);
+			put_table (to, "INDEX", "include", i,
+				   p->include_count > 0);
+			fprintf (to, ", %zu, %d },\n", p->include_count,
+				 p->separate);
+		}
+
+		fputs ("};\n\n", to);
+	}
+
+	fprintf (to, "const struct pfp_corpus pfp_builtin = {\n"
+		     "\t.set   = %s,\n"
+		     "\t.count = %zu, .avail = %zu,\n"
+		     "\t.block = %s,\n"
+		     "\t.block_count = %zu, .block_avail = %zu,\n"
+		     "};\n",
+		 c->count > 0 ? "(struct pfp_print *) print" : "NULL",
+		 c->count, c->count,
+		 c->block_count > 0 ? "(struct pfp_block *) block" : "NULL",
+		 c->block_count, c->block_count);
+
+	free (order);
+	return 1;
+no_sort:
+	free (order);
+	return 0;
+}
+
+int main (int argc, char *argv[])
+{
+	struct pfp_corpus c;
+	int i, ret = 1;
+
+	if (argc < 2) {
+		fprintf (stderr, "usage:\n"
+				 "\tpfp-embed rule-directory ... > "
+				 "pfp-builtin.c\n");
+		return 1;
+	}
+
+	pfp_corpus_init (&c);
+
+	for (i = 1; i < argc; ++i)
+		if (!pfp_corpus_load (&c, argv[i])) {
+			if (c.error != NULL)
+				fprintf (stderr, "pfp-embed: %s\n", c.error);
+			else
+				perror (argv[i]);
+
+			goto no_load;
+		}
+
+	if (!put_corpus (stdout, &c) || fflush (stdout) != 0 ||
+	    ferror (stdout)) {
+		perror ("pfp-embed");
+		goto no_put;
+	}
+
+	ret = 0;
+no_put:
+no_load:
+	pfp_corpus_fini (&c);
+	return ret;
+}
@@ -0,0 +1,559 @@
+/*
+ * PCI Finger-Print Formatter
+ *
+ * Copyright (c) 2016-2024 Alexei A. Smekalkine <ikle@ikle.ru>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pfp-format.h"
+
+void pfp_buf_init (struct pfp_buf *o)
+{
+	o->data = NULL;
+	o->len  = o->avail = 0;
+}
+
+void pfp_buf_fini (struct pfp_buf *o)
+{
+	free (o->data);
+}
+
+static int pfp_buf_grow (struct pfp_buf *o, size_t len)
+{
+	size_t avail = o->avail > 0 ? o->avail : 4096;
+	char *p;
+
+	if (o->len + len <= o->avail)
+		return 1;
+
+	while (avail < o->len + len)
+		avail *= 2;
+
+	if ((p = realloc (o->data, avail)) == NULL)
+		return 0;
+
+	o->data  = p;
+	o->avail = avail;
+	return 1;
+}
+
+int pfp_buf_write (struct pfp_buf *o, const void *data, size_t len)
+{
+	if (!pfp_buf_grow (o, len))
+		return 0;
+
+	memcpy (o->data + o->len, data, len);
+	o->len += len;
+	return 1;
+}
+
+int pfp_buf_printf (struct pfp_buf *o, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	va_start (ap, fmt);
+	len = vsnprintf (o->data + o->len, o->avail - o->len, fmt, ap);
+	va_end (ap);
+
+	if (len < 0)
+		return 0;
+
+	if (o->len + len < o->avail) {
+		o->len += len;
+		return 1;
+	}
+
+	if (!pfp_buf_grow (o, len + 1))
+		return 0;
+
+	va_start (ap, fmt);
+	vsnprintf (o->data + o->len, o->avail - o->len, fmt, ap);
+	va_end (ap);
+
+	o->len += len;
+	return 1;
+}
+
+int pfp_buf_flush (struct pfp_buf *o, FILE *to)
+{
+	int ok;
+
+	ok = (o->len == 0 || fwrite (o->data, 1, o->len, to) == o->len) &&
+	     fflush (to) == 0;
+
+	o->len = 0;
+	return ok;
+}
+
+int pfp_format_parse (const char *name)
+{
+	if (strcmp (name, "text") == 0)
+		return PFP_FORMAT_TEXT;
+
+	if (strcmp (name, "json") == 0)
+		return PFP_FORMAT_JSON;
+
+	if (strcmp (name, "bin") == 0)
+		return PFP_FORMAT_BIN;
+
+	return -1;
+}
+
+/* text form */
+
+static int show_sbdf (struct pfp_buf *o, const struct pfp_sbdf *s,
+		      const char *prefix)
+{
+	if (s->segment < 0)
+		return 1;
+
+	if (s->segment != 0)
+		return pfp_buf_printf (o, "%s\t= %x:%x:%x.%x\n", prefix,
+				       s->segment, s->bus, s->device,
+				       s->function);
+
+	if (s->bus != 0)
+		return pfp_buf_printf (o, "%s\t= %x:%x.%x\n", prefix,
+				       s->bus, s->device, s->function);
+
+	return pfp_buf_printf (o, "%s\t= %x.%x\n", prefix,
+			       s->device, s->function);
+}
+
+/*
+ * Identifier pattern: hex digits with question marks for wild nibbles,
+ * or range if wild bits do not fill nibbles
+ */
+static int show_pattern (struct pfp_buf *o, int id, int wild, int width)
+{
+	char s[8];
+	int i, shift, n;
+
+	if (wild == 0)
+		return pfp_buf_printf (o, "%0*x", width, id);
+
+	for (i = 0; i < width; ++i) {
+		shift = (width - 1 - i) * 4;
+		n = wild >> shift & 0xf;
+
+		if (n != 0 && n != 0xf)
+			return pfp_buf_printf (o, "%0*x-%0*x", width, id,
+					       width, id | wild);
+
+		s[i] = n != 0 ? '?' : "0123456789abcdef"[id >> shift & 0xf];
+	}
+
+	return pfp_buf_write (o, s, width);
+}
+
+static int show_id (struct pfp_buf *o, int id, int wild, const char *prefix)
+{
+	return id < 0 ||
+	       (pfp_buf_printf (o, "%s\t= ", prefix) &&
+		show_pattern (o, id, wild, 4) && pfp_buf_write (o, "\n", 1));
+}
+
+static int show_class (struct pfp_buf *o, const struct pfp_rule *r)
+{
+	const int width = r->wild.interface != 0 ? 2 : 1;
+	const int class = r->class < 0 ? 0 : r->class;
+	const int wild  = r->class < 0 ? 0xffff : r->wild.class;
+
+	if (r->interface < 0)
+		return show_id (o, r->class, r->wild.class, "class");
+
+	return	pfp_buf_printf (o, "class\t= ") &&
+		show_pattern (o, class, wild, 4) &&
+		pfp_buf_write (o, ".", 1) &&
+		show_pattern (o, r->interface, r->wild.interface, width) &&
+		pfp_buf_write (o, "\n", 1);
+}
+
+static int show_int (struct pfp_buf *o, int x, const char *prefix)
+{
+	return x < 0 || pfp_buf_printf (o, "%s\t= %d\n", prefix, x);
+}
+
+static int show_attr (struct pfp_buf *o, const struct pfp_attr *a)
+{
+	return	(a->driver == NULL ||
+		 pfp_buf_printf (o, "driver\t= %s\n", a->driver))	&&
+		show_int (o, a->numa,  "numa")				&&
+		show_int (o, a->iommu, "iommu")				&&
+		(a->speed == NULL ||
+		 pfp_buf_printf (o, "speed\t= %s GT/s\n", a->speed))	&&
+		show_int (o, a->width, "width");
+}
+
+static int show_rule (struct pfp_buf *o, const struct pfp_rule *r,
+		      int verbose)
+{
+	if (r->include != NULL)
+		return pfp_buf_printf (o, "include\t= %s\n", r->include);
+
+	if (r->path != NULL &&
+	    !(r->name != NULL ?
+	      pfp_buf_printf (o, "path\t= %s (%s)\n", r->path, r->name) :
+	      pfp_buf_printf (o, "path\t= %s\n", r->path)))
+		return 0;
+
+	if ((r->path == NULL || verbose > 0) &&
+	    !(show_sbdf (o, &r->parent, "parent") &&
+	      show_sbdf (o, &r->slot, "slot")))
+		return 0;
+
+	if (!show_class (o, r) ||
+	    !show_id (o, r->vendor, r->wild.vendor, "vendor") ||
+	    !show_id (o, r->device, r->wild.device, "device"))
+		return 0;
+
+	if (((r->svendor != 0 && r->svendor != 0xffff &&
+	      (r->svendor != r->vendor || r->sdevice != r->device)) ||
+	     r->wild.svendor != 0 || r->wild.sdevice != 0 || verbose > 1) &&
+	    !(show_id (o, r->svendor, r->wild.svendor, "svendor") &&
+	      show_id (o, r->sdevice, r->wild.sdevice, "sdevice")))
+		return 0;
+
+	return show_attr (o, &r->attr);
+}
+
+int pfp_format_rule (struct pfp_buf *o, const struct pfp_rule *r, int verbose)
+{
+	return show_rule (o, r, verbose);
+}
+
+static int format_text (struct pfp_buf *o, const struct pfp_rule *r,
+			int verbose)
+{
+	for (; r != NULL; r = r->next)
+		if (!show_rule (o, r, verbose) ||
+		    (r->next != NULL && !pfp_buf_write (o, "\n", 1)))
+			return 0;
+
+	return 1;
+}
+
+/* JSON form */
+
+static int json_string (struct pfp_buf *o, const char *key, const char *s)
+{
+	if (s == NULL)
+		return 1;
+
+	if (!pfp_buf_printf (o, ", \"%s\": \"", key))
+		return 0;
+
+	for (; *s != '\0'; ++s)
+		if (!((*s == '"' || *s == '\\') ?
+		      pfp_buf_printf (o, "\\%c", *s) :
+		      (unsigned char) *s < 0x20 ?
+		      pfp_buf_printf (o, "\\u%04x", *s) :
+		      pfp_buf_write (o, s, 1)))
+			return 0;
+
+	return pfp_buf_write (o, "\"", 1);
+}
+
+static int json_sbdf (struct pfp_buf *o, const char *key,
+		      const struct pfp_sbdf *s)
+{
+	return s->segment < 0 ||
+	       pfp_buf_printf (o, ", \"%s\": \"%04x:%02x:%02x.%x\"", key,
+			       s->segment, s->bus, s->device, s->function);
+}
+
+static int json_id (struct pfp_buf *o, const char *key, int id, int wild,
+		    int width)
+{
+	return id < 0 ||
+	       (pfp_buf_printf (o, ", \"%s\": \"", key) &&
+		show_pattern (o, id, wild, width) &&
+		pfp_buf_write (o, "\"", 1));
+}
+
+static int json_int (struct pfp_buf *o, const char *key, int x)
+{
+	return x < 0 || pfp_buf_printf (o, ", \"%s\": %d", key, x);
+}
+
+static int json_rule (struct pfp_buf *o, const struct pfp_rule *r)
+{
+	const struct pfp_wild *w = &r->wild;
+
+	return	pfp_buf_printf (o, "{\"segment\": %d", r->segment)	&&
+		json_string (o, "path",   r->path)			&&
+		json_sbdf   (o, "parent", &r->parent)			&&
+		json_sbdf   (o, "slot",   &r->slot)			&&
+		json_id (o, "class",     r->class,     w->class,     4)	&&
+		json_id (o, "interface", r->interface, w->interface, 2)	&&
+		json_id (o, "vendor",    r->vendor,    w->vendor,    4)	&&
+		json_id (o, "device",    r->device,    w->device,    4)	&&
+		json_id (o, "svendor",   r->svendor,   w->svendor,   4)	&&
+		json_id (o, "sdevice",   r->sdevice,   w->sdevice,   4)	&&
+		json_string (o, "name",   r->name)			&&
+		json_string (o, "driver", r->attr.driver)		&&
+		json_int    (o, "numa",   r->attr.numa)			&&
+		json_int    (o, "iommu",  r->attr.iommu)		&&
+		json_string (o, "speed",  r->attr.speed)		&&
+		json_int    (o, "width",  r->attr.width)		&&
+		json_string (o, "include", r->include)			&&
+		pfp_buf_write (o, "}", 1);
+}
+
+static int format_json (struct pfp_buf *o, const struct pfp_rule *r)
+{
+	if (!pfp_buf_write (o, "[", 1))
+		return 0;
+
+	for (; r != NULL; r = r->next)
+		if (!pfp_buf_write (o, "\n\t", 2) || !json_rule (o, r) ||
+		    (r->next != NULL && !pfp_buf_write (o, ",", 1)))
+			return 0;
+
+	return pfp_buf_write (o, "\n]\n", 3);
+}
+
+/*
+ * Binary form: magic, version and rule count followed by rules. Every
+ * rule is a sequence of little-endian 32-bit integers (segment, parent
+ * segment and bus:device.function, slot segment and bus:device.function,
+ * class, interface, vendor, device, svendor, sdevice and don't care bits
+ * of the same six identifiers) followed by path and name strings, then
+ * extra device info: driver and link speed strings, NUMA node, IOMMU
+ * group and link width, and included block file name string. String is
+ * a 32-bit length followed by characters, NULL string has length
+ * 0xffffffff. Version 1 has no don't care bits, versions 1 and 2 have no
+ * extra device info, versions 1 to 3 have no include.
+ */
+
+#define BIN_VERSION  4
+#define BIN_NULL     0xffffffff
+
+int pfp_buf_put_u32 (struct pfp_buf *o, uint32_t x)
+{
+	unsigned char b[4] = { x, x >> 8, x >> 16, x >> 24 };
+
+	return pfp_buf_write (o, b, sizeof (b));
+}
+
+static int put_sbdf (struct pfp_buf *o, const struct pfp_sbdf *s)
+{
+	const uint32_t bdf = s->bus << 16 | s->device << 8 | s->function;
+
+	return pfp_buf_put_u32 (o, s->segment) && pfp_buf_put_u32 (o, bdf);
+}
+
+int pfp_buf_put_string (struct pfp_buf *o, const char *s)
+{
+	size_t len = s == NULL ? BIN_NULL : strlen (s);
+
+	return pfp_buf_put_u32 (o, len) &&
+	       (s == NULL || pfp_buf_write (o, s, len));
+}
+
+static int bin_rule (struct pfp_buf *o, const struct pfp_rule *r)
+{
+	return	pfp_buf_put_u32 (o, r->segment)		&&
+		put_sbdf (o, &r->parent)		&&
+		put_sbdf (o, &r->slot)			&&
+		pfp_buf_put_u32 (o, r->class)		&&
+		pfp_buf_put_u32 (o, r->interface)	&&
+		pfp_buf_put_u32 (o, r->vendor)		&&
+		pfp_buf_put_u32 (o, r->device)		&&
+		pfp_buf_put_u32 (o, r->svendor)		&&
+		pfp_buf_put_u32 (o, r->sdevice)		&&
+		pfp_buf_put_u32 (o, r->wild.class)	&&
+		pfp_buf_put_u32 (o, r->wild.interface)	&&
+		pfp_buf_put_u32 (o, r->wild.vendor)	&&
+		pfp_buf_put_u32 (o, r->wild.device)	&&
+		pfp_buf_put_u32 (o, r->wild.svendor)	&&
+		pfp_buf_put_u32 (o, r->wild.sdevice)	&&
+		pfp_buf_put_string (o, r->path)		&&
+		pfp_buf_put_string (o, r->name)		&&
+		pfp_buf_put_string (o, r->attr.driver)	&&
+		pfp_buf_put_string (o, r->attr.speed)	&&
+		pfp_buf_put_u32 (o, r->attr.numa)	&&
+		pfp_buf_put_u32 (o, r->attr.iommu)	&&
+		pfp_buf_put_u32 (o, r->attr.width)	&&
+		pfp_buf_put_string (o, r->include);
+}
+
+static int format_bin (struct pfp_buf *o, const struct pfp_rule *r)
+{
+	static const char magic[4] = { PFP_FORMAT_BIN_MAGIC, 'P', 'F', 'P' };
+
+	if (!pfp_buf_write (o, magic, sizeof (magic)) ||
+	    !pfp_buf_put_u32 (o, BIN_VERSION) ||
+	    !pfp_buf_put_u32 (o, pfp_rule_count (r)))
+		return 0;
+
+	for (; r != NULL; r = r->next)
+		if (!bin_rule (o, r))
+			return 0;
+
+	return 1;
+}
+
+int pfp_format (struct pfp_buf *o, const struct pfp_rule *r, int format,
+		int verbose)
+{
+	switch (format) {
+	case PFP_FORMAT_TEXT:	return format_text (o, r, verbose);
+	case PFP_FORMAT_JSON:	return format_json (o, r);
+	case PFP_FORMAT_BIN:	return format_bin (o, r);
+	}
+
+	errno = EINVAL;
+	return 0;
+}
+
+int pfp_cursor_get_u32 (struct pfp_cursor *o, uint32_t *x)
+{
+	if (o->avail < 4)
+		return 0;
+
+	*x = o->p[0] | o->p[1] << 8 | o->p[2] << 16 | (uint32_t) o->p[3] << 24;
+
+	o->p     += 4;
+	o->avail -= 4;
+	return 1;
+}
+
+static int get_int (struct pfp_cursor *o, int *x)
+{
+	uint32_t v;
+
+	if (!pfp_cursor_get_u32 (o, &v))
+		return 0;
+
+	*x = (int32_t) v;
+	return 1;
+}
+
+static int get_sbdf (struct pfp_cursor *o, struct pfp_sbdf *s)
+{
+	uint32_t v;
+
+	if (!get_int (o, &s->segment) || !pfp_cursor_get_u32 (o, &v))
+		return 0;
+
+	s->bus      = v >> 16;
+	s->device   = v >> 8;
+	s->function = v;
+	return 1;
+}
+
+int pfp_cursor_get_string (struct pfp_cursor *o, char **s)
+{
+	uint32_t len;
+
+	if (!pfp_cursor_get_u32 (o, &len))
+		return 0;
+
+	if (len == BIN_NULL)
+		return 1;
+
+	if (o->avail < len || (*s = malloc (len + 1)) == NULL)
+		return 0;
+
+	memcpy (*s, o->p, len);
+	(*s)[len] = '\0';
+
+	o->p     += len;
+	o->avail -= len;
+	return 1;
+}
+
+static int load_wild (struct pfp_cursor *o, struct pfp_wild *w)
+{
+	return	get_int (o, &w->class)			&&
+		get_int (o, &w->interface)		&&
+		get_int (o, &w->vendor)			&&
+		get_int (o, &w->device)			&&
+		get_int (o, &w->svendor)		&&
+		get_int (o, &w->sdevice);
+}
+
+static int load_attr (struct pfp_cursor *o, struct pfp_attr *a)
+{
+	return	pfp_cursor_get_string (o, &a->driver)	&&
+		pfp_cursor_get_string (o, &a->speed)	&&
+		get_int (o, &a->numa)			&&
+		get_int (o, &a->iommu)			&&
+		get_int (o, &a->width);
+}
+
+static int
+load_rule (struct pfp_cursor *o, struct pfp_rule *r, uint32_t version)
+{
+	return	get_int (o, &r->segment)		&&
+		get_sbdf (o, &r->parent)		&&
+		get_sbdf (o, &r->slot)			&&
+		get_int (o, &r->class)			&&
+		get_int (o, &r->interface)		&&
+		get_int (o, &r->vendor)			&&
+		get_int (o, &r->device)			&&
+		get_int (o, &r->svendor)		&&
+		get_int (o, &r->sdevice)		&&
+		(version < 2 || load_wild (o, &r->wild))	&&
+		pfp_cursor_get_string (o, &r->path)	&&
+		pfp_cursor_get_string (o, &r->name)	&&
+		(version < 3 || load_attr (o, &r->attr))	&&
+		(version < 4 || pfp_cursor_get_string (o, &r->include));
+}
+
+struct pfp_rule *pfp_format_load (const void *data, size_t len)
+{
+	struct pfp_cursor c = { data, len };
+	struct pfp_rule *head = NULL, **tail = &head, *rule;
+	uint32_t version, count;
+
+	if (len < 4 || c.p[0] != PFP_FORMAT_BIN_MAGIC ||
+	    memcmp (c.p + 1, "PFP", 3) != 0)
+		goto no_format;
+
+	c.p += 4, c.avail -= 4;
+
+	if (!pfp_cursor_get_u32 (&c, &version) ||
+	    version < 1 || version > BIN_VERSION ||
+	    !pfp_cursor_get_u32 (&c, &count))
+		goto no_format;
+
+	for (; count > 0; --count) {
+		if ((rule = pfp_rule_alloc ()) == NULL)
+			goto no_rule;
+
+		*tail = rule;
+		tail = &rule->next;
+
+		if (!load_rule (&c, rule, version))
+			goto no_format;
+	}
+
+	return head;
+no_format:
+	errno = EINVAL;
+no_rule:
+	pfp_rule_free (head);
+	return NULL;
+}
+
+void pfp_rule_show (struct pfp_rule *o, FILE *to, int verbose)
+{
+	struct pfp_buf b;
+
+	pfp_buf_init (&b);
+
+	if (format_text (&b, o, verbose))
+		pfp_buf_flush (&b, to);
+
+	pfp_buf_fini (&b);
+}
@@ -0,0 +1,68 @@
+/*
+ * PCI Finger-Print Formatter
+ *
+ * Copyright (c) 2016-2024 Alexei A. Smekalkine <ikle@ikle.ru>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef PFP_FORMAT_H
+#define PFP_FORMAT_H  1
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "pfp-rule.h"
+
+struct pfp_buf {
+	char *data;
+	size_t len, avail;
+};
+
+void pfp_buf_init (struct pfp_buf *o);
+void pfp_buf_fini (struct pfp_buf *o);
+
+int pfp_buf_write (struct pfp_buf *o, const void *data, size_t len);
+int pfp_buf_printf (struct pfp_buf *o, const char *fmt, ...);
+
+/* write out and drop buffer content */
+int pfp_buf_flush (struct pfp_buf *o, FILE *to);
+
+/* binary form primitives: little-endian integers and counted strings */
+int pfp_buf_put_u32 (struct pfp_buf *o, uint32_t x);
+int pfp_buf_put_string (struct pfp_buf *o, const char *s);
+
+struct pfp_cursor {
+	const unsigned char *p;
+	size_t avail;
+};
+
+int pfp_cursor_get_u32 (struct pfp_cursor *o, uint32_t *x);
+int pfp_cursor_get_string (struct pfp_cursor *o, char **s);
+
+enum pfp_format {
+	PFP_FORMAT_TEXT,
+	PFP_FORMAT_JSON,
+	PFP_FORMAT_BIN,
+};
+
+int pfp_format_parse (const char *name);
+
+/*
+ * Append single rule formatted as finger-print text into buffer: slots
+ * of devices with path shown if verbose, subsystem ids always shown if
+ * verbose > 1
+ */
+int pfp_format_rule (struct pfp_buf *o, const struct pfp_rule *r, int verbose);
+
+/* append rule list formatted into buffer */
+int pfp_format (struct pfp_buf *o, const struct pfp_rule *r, int format,
+		int verbose);
+
+/* binary form starts with this byte, text one cannot */
+#define PFP_FORMAT_BIN_MAGIC  0x7f
+
+/* load rule list from binary form */
+struct pfp_rule *pfp_format_load (const void *data, size_t len);
+
+#endif  /* PFP_FORMAT_H */
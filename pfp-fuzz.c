@@ -0,0 +1,81 @@
+/*
+ * PCI Finger-Print Parser Fuzzing Harness
+ *
+ * Copyright (c) 2016-2024 Alexei A. Smekalkine <ikle@ikle.ru>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pfp-format.h"
+#include "pfp-parser.h"
+
+/*
+ * libFuzzer entry: input is loaded as text or binary form depending on
+ * the first byte and formatted back. Accepted text must survive round
+ * trip: parsing canonical view of it must give the same canonical view.
+ */
+
+static struct pfp_parser *parser;
+
+static struct pfp_rule *parse (const void *data, size_t size)
+{
+	FILE *f;
+	struct pfp_rule *r;
+
+	if ((f = fmemopen ((void *) data, size, "r")) == NULL)
+		return NULL;
+
+	pfp_parser_reset (parser, f);
+	r = pfp_parser_run (parser);
+
+	fclose (f);
+	return r;
+}
+
+int LLVMFuzzerTestOneInput (const uint8_t *data, size_t size)
+{
+	const int bin = size > 0 && data[0] == PFP_FORMAT_BIN_MAGIC;
+	struct pfp_rule *r;
+	struct pfp_buf a, b;
+
+	if (size == 0)
+		return 0;
+
+	if (parser == NULL && (parser = pfp_parser_alloc (NULL)) == NULL)
+		abort ();
+
+	r = bin ? pfp_format_load (data, size) : parse (data, size);
+
+	if (r == NULL)
+		return 0;
+
+	pfp_buf_init (&a);
+	pfp_buf_init (&b);
+
+	if (!pfp_format (&a, r, PFP_FORMAT_TEXT, 2) ||
+	    !pfp_format (&b, r, PFP_FORMAT_JSON, 2) ||
+	    !pfp_format (&b, r, PFP_FORMAT_BIN, 2))
+		abort ();
+
+	pfp_rule_free (r);
+
+	if (!bin) {
+		b.len = 0;
+
+		if ((r = parse (a.data, a.len)) == NULL ||
+		    !pfp_format (&b, r, PFP_FORMAT_TEXT, 2) ||
+		    a.len != b.len || memcmp (a.data, b.data, a.len) != 0)
+			abort ();
+
+		pfp_rule_free (r);
+	}
+
+	pfp_buf_fini (&b);
+	pfp_buf_fini (&a);
+	return 0;
+}
@@ -0,0 +1,178 @@
+/*
+ * PCI Finger-Print Rule Index
+ *
+ * Copyright (c) 2016-2024 Alexei A. Smekalkine <ikle@ikle.ru>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdlib.h>
+
+#include "pfp-index.h"
+
+enum key {
+	KEY_PATH = 1,
+	KEY_SLOT,
+	KEY_ID,
+};
+
+struct pfp_index_node {
+	struct pfp_index_node *next;
+	const struct pfp_rule *rule;
+	size_t index;
+	unsigned key, hash;
+};
+
+static unsigned hash_mix (unsigned h, unsigned x)
+{
+	return (h ^ x) * 16777619;  /* FNV-1a step */
+}
+
+static unsigned hash_path (const char *path)
+{
+	unsigned h = hash_mix (2166136261, KEY_PATH);
+
+	for (; *path != '\0'; ++path)
+		h = hash_mix (h, (unsigned char) *path);
+
+	return h;
+}
+
+static unsigned hash_slot (const struct pfp_sbdf *s)
+{
+	unsigned h = hash_mix (2166136261, KEY_SLOT);
+
+	h = hash_mix (h, s->segment);
+	h = hash_mix (h, s->bus);
+	h = hash_mix (h, s->device);
+	return hash_mix (h, s->function);
+}
+
+static unsigned hash_id (int vendor, int device)
+{
+	unsigned h = hash_mix (2166136261, KEY_ID);
+
+	h = hash_mix (h, vendor);
+	return hash_mix (h, device);
+}
+
+static int exact_id (const struct pfp_rule *r)
+{
+	return	r->vendor >= 0 && r->wild.vendor == 0 &&
+		r->device >= 0 && r->wild.device == 0;
+}
+
+static void add (struct pfp_index *o, struct pfp_index_node *n,
+		 const struct pfp_rule *r, size_t index, unsigned key,
+		 unsigned hash)
+{
+	struct pfp_index_node **bucket = o->table + (hash & (o->size - 1));
+
+	n->next  = *bucket;
+	n->rule  = r;
+	n->index = index;
+	n->key   = key;
+	n->hash  = hash;
+
+	*bucket = n;
+}
+
+int pfp_index_init (struct pfp_index *o, const struct pfp_rule *list)
+{
+	const struct pfp_rule *r;
+	struct pfp_index_node *n;
+	size_t i;
+
+	o->list   = list;
+	o->count  = pfp_rule_count (list);
+	o->nopath = 0;
+
+	for (o->size = 16; o->size < o->count * 3; o->size *= 2) {}
+
+	if ((o->table = calloc (o->size, sizeof (o->table[0]))) == NULL)
+		return 0;
+
+	o->node = malloc (sizeof (o->node[0]) * (o->count * 3 + 1));
+
+	if (o->node == NULL) {
+		free (o->table);
+		return 0;
+	}
+
+	for (n = o->node, i = 0, r = list; r != NULL; ++i, r = r->next) {
+		if (r->path != NULL)
+			add (o, n++, r, i, KEY_PATH, hash_path (r->path));
+		else
+			++o->nopath;
+
+		if (r->slot.segment >= 0)
+			add (o, n++, r, i, KEY_SLOT, hash_slot (&r->slot));
+
+		if (exact_id (r))
+			add (o, n++, r, i, KEY_ID,
+			     hash_id (r->vendor, r->device));
+	}
+
+	return 1;
+}
+
+void pfp_index_fini (struct pfp_index *o)
+{
+	free (o->table);
+	free (o->node);
+}
+
+static size_t match_all (const struct pfp_index *o,
+			 const struct pfp_rule *pattern,
+			 pfp_index_fn *fn, void *cookie)
+{
+	const struct pfp_rule *r;
+	size_t i, count;
+
+	for (count = 0, i = 0, r = o->list; r != NULL; ++i, r = r->next)
+		if (pfp_rule_test (r, pattern)) {
+			if (fn != NULL)
+				fn (r, i, cookie);
+
+			++count;
+		}
+
+	return count;
+}
+
+size_t pfp_index_match (const struct pfp_index *o,
+			const struct pfp_rule *pattern,
+			pfp_index_fn *fn, void *cookie)
+{
+	const struct pfp_index_node *n;
+	unsigned key, hash;
+	size_t count;
+
+	if (pattern->path != NULL && o->nopath == 0) {
+		key  = KEY_PATH;
+		hash = hash_path (pattern->path);
+	}
+	else if (pattern->path == NULL && pattern->slot.segment >= 0) {
+		key  = KEY_SLOT;
+		hash = hash_slot (&pattern->slot);
+	}
+	else if (exact_id (pattern)) {
+		key  = KEY_ID;
+		hash = hash_id (pattern->vendor, pattern->device);
+	}
+	else
+		return match_all (o, pattern, fn, cookie);
+
+	n = o->table[hash & (o->size - 1)];
+
+	for (count = 0; n != NULL; n = n->next)
+		if (n->key == key && n->hash == hash &&
+		    pfp_rule_test (n->rule, pattern)) {
+			if (fn != NULL)
+				fn (n->rule, n->index, cookie);
+
+			++count;
+		}
+
+	return count;
+}
@@ -0,0 +1,41 @@
+/*
+ * PCI Finger-Print Rule Index
+ *
+ * Copyright (c) 2016-2024 Alexei A. Smekalkine <ikle@ikle.ru>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef PFP_INDEX_H
+#define PFP_INDEX_H  1
+
+#include "pfp-rule.h"
+
+/*
+ * Hash index of device list by path, by slot and by vendor and device
+ * identifiers, used to find devices matched by a pattern rule without
+ * walking the whole list.
+ */
+struct pfp_index {
+	const struct pfp_rule *list;
+	size_t count, size, nopath;
+	struct pfp_index_node **table;
+	struct pfp_index_node *node;
+};
+
+int pfp_index_init (struct pfp_index *o, const struct pfp_rule *list);
+void pfp_index_fini (struct pfp_index *o);
+
+/*
+ * Call fn for every indexed device matched by pattern, index is the
+ * ordinal number of device in the list. Returns number of matches, fn
+ * may be NULL to count matches only.
+ */
+typedef void pfp_index_fn (const struct pfp_rule *o, size_t index,
+			   void *cookie);
+
+size_t pfp_index_match (const struct pfp_index *o,
+			const struct pfp_rule *pattern,
+			pfp_index_fn *fn, void *cookie);
+
+#endif  /* PFP_INDEX_H */
@@ -15,9 +15,13 @@
 struct pfp_parser *pfp_parser_alloc (FILE *from);
 void pfp_parser_free (struct pfp_parser *o);
 
+/* returns NULL with errno set to EINVAL on syntax error */
 struct pfp_rule *pfp_parser_run (struct pfp_parser *o);
 void pfp_parser_reset (struct pfp_parser *o, FILE *from);
 
+/* return reason and line of last failure or NULL */
+const char *pfp_parser_error (struct pfp_parser *o, int *line);
+
 /* all in one */
 struct pfp_rule *pfp_parse (FILE *from);
 
@@ -6,11 +6,13 @@
  * SPDX-License-Identifier: BSD-2-Clause
  */
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include <glob.h>
+#include <dirent.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 #include "pfp-rule.h"
@@ -33,62 +35,297 @@ static char *add_name (char *list, const char *name)
 	return p;
 }
 
-static char *get_device_name (const char *class, const char *device)
+/*
+ * Attributes are read relative to device directory opened once, thus
+ * sysfs path lookup is done once per device
+ */
+static int open_device (const struct pfp_rule *o)
+{
+	char path[64];
+
+	snprintf (path, sizeof (path), "/sys/bus/pci/devices/%04x:%02x:%02x.%o",
+		  o->slot.segment, o->slot.bus,
+		  o->slot.device,  o->slot.function);
+
+	return open (path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+static const char *file_names[PFP_FILE_COUNT] = {
+	"numa_node",
+	"current_link_speed",
+	"current_link_width",
+};
+
+const char *pfp_attr_file (int file, int attrs)
+{
+	switch (file) {
+	case PFP_FILE_NUMA:
+		return (attrs & PFP_ATTR_NUMA) != 0 ? file_names[file] : NULL;
+	case PFP_FILE_SPEED:
+	case PFP_FILE_WIDTH:
+		return (attrs & PFP_ATTR_LINK) != 0 ? file_names[file] : NULL;
+	}
+
+	return NULL;
+}
+
+/* device directory or files read in advance */
+struct source {
+	int dir;
+	const struct pfp_attr_files *files;
+};
+
+static int read_attr (const struct source *s, int file, char *buf, size_t size)
+{
+	int fd;
+	ssize_t len;
+
+	if (s->files != NULL) {
+		if ((len = s->files->len[file]) <= 0)
+			return 0;
+
+		snprintf (buf, size, "%s", s->files->text[file]);
+	}
+	else {
+		if ((fd = openat (s->dir, file_names[file], O_RDONLY | O_CLOEXEC)) < 0)
+			return 0;
+
+		len = read (fd, buf, size - 1);
+		close (fd);
+
+		if (len <= 0)
+			return 0;
+
+		buf[len] = '\0';
+	}
+
+	buf[strcspn (buf, "\n")] = '\0';
+	return 1;
+}
+
+static int read_int (const struct source *s, int file, int *x)
+{
+	char buf[16];
+
+	return read_attr (s, file, buf, sizeof (buf)) &&
+	       sscanf (buf, "%d", x) == 1;
+}
+
+/* return last component of symbolic link target */
+static const char *read_link (int dir, const char *name, char *buf,
+			      size_t size)
 {
-	char *name = NULL, *p;
-	glob_t g;
-	size_t i;
-	char link[128];
 	ssize_t len;
+	const char *p;
 
-	snprintf (link, sizeof (link), "/sys/class/%s/*/device",
-		  class != NULL ? class : "*");
+	if ((len = readlinkat (dir, name, buf, size - 1)) <= 0)
+		return NULL;
 
-	if (glob (link, 0, NULL, &g) == 0)
-		for (i = 0; i < g.gl_pathc; ++i) {
-			len = readlink (g.gl_pathv[i], link, sizeof (link));
+	buf[len] = '\0';
 
-			if (len <= 0 || len >= sizeof (link))
-				continue;
+	p = strrchr (buf, '/');
+	return p != NULL ? p + 1 : buf;
+}
 
-			link[len] = '\0';
+static int name_cmp (const void *a, const void *b)
+{
+	const char *const *p = a, *const *q = b;
 
-			p = strrchr (link, '/');
-			p = (p != NULL) ? p + 1 : link;
+	return strcmp (*p, *q);
+}
 
-			if (strcmp (p, device) != 0)
-				continue;
+static void free_names (char **set, int count)
+{
+	int i;
+
+	for (i = 0; i < count; ++i)
+		free (set[i]);
+
+	free (set);
+}
+
+/* sorted names of subdirectories, returns count or -1 on failure */
+static int read_dirs (int dir, const char *path, char ***list)
+{
+	DIR *d;
+	struct dirent *e;
+	char **set = NULL, **p;
+	int fd, n = 0, avail = 0;
+
+	if ((fd = openat (dir, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+		return -1;
+
+	if ((d = fdopendir (fd)) == NULL) {
+		close (fd);
+		return -1;
+	}
 
-			if ((p = strrchr (g.gl_pathv[i], '/')) != NULL)
-				*p = '\0';
+	while ((e = readdir (d)) != NULL) {
+		if (e->d_name[0] == '.' ||
+		    (e->d_type != DT_DIR && e->d_type != DT_UNKNOWN))
+			continue;
 
-			p = g.gl_pathv[i] + 11;
+		if (n >= avail) {
+			avail = avail > 0 ? avail * 2 : 16;
 
-			if ((p = strchr (p, '/')) != NULL)
-				*p = ' ';
+			if ((p = realloc (set, sizeof (p[0]) * avail)) == NULL)
+				break;
 
-			name = add_name (name, g.gl_pathv[i] + 11);
+			set = p;
 		}
 
-	globfree (&g);
+		if ((set[n] = strdup (e->d_name)) == NULL)
+			break;
+
+		++n;
+	}
+
+	closedir (d);
+
+	if (n > 0)
+		qsort (set, n, sizeof (set[0]), name_cmp);
+
+	*list = set;
+	return n;
+}
+
+/* class device links its class as subsystem: ../../../class/net */
+static int is_class_device (int dir, const char *class, const char *name)
+{
+	char path[NAME_MAX * 2 + 16], buf[256];
+	const char *p;
+
+	snprintf (path, sizeof (path), "%s/%s/subsystem", class, name);
+
+	if ((p = read_link (dir, path, buf, sizeof (buf))) == NULL ||
+	    strcmp (p, class) != 0)
+		return 0;
+
+	return p - buf >= 7 && strncmp (p - 7, "/class/", 7) == 0;
+}
+
+/*
+ * Class devices of PCI device are kept in class directories of device
+ * directory (net/eth0, nvme/nvme0), thus only the device itself is
+ * looked at. Names are sorted by class, then by name.
+ */
+static char *get_device_name (int dir, const char *class)
+{
+	char **cl, **dev, *name = NULL, buf[NAME_MAX * 2 + 2];
+	int i, j, n, m;
+
+	if ((n = read_dirs (dir, ".", &cl)) < 0)
+		return NULL;
+
+	for (i = 0; i < n; ++i) {
+		if ((class != NULL && strcmp (cl[i], class) != 0) ||
+		    (m = read_dirs (dir, cl[i], &dev)) < 0)
+			continue;
+
+		for (j = 0; j < m; ++j)
+			if (is_class_device (dir, cl[i], dev[j])) {
+				snprintf (buf, sizeof (buf), "%s %s",
+					  cl[i], dev[j]);
+				name = add_name (name, buf);
+			}
+
+		free_names (dev, m);
+	}
+
+	free_names (cl, n);
 	return name;
 }
 
-static void pfp_rule_fill_name (struct pfp_rule *o, const char *class)
+static void fill_attr (struct pfp_rule *o, const struct source *s, int attrs)
+{
+	struct pfp_attr *a = &o->attr;
+	char buf[256], speed[16];
+	const char *p;
+
+	if ((attrs & PFP_ATTR_DRIVER) != 0 && a->driver == NULL &&
+	    (p = read_link (s->dir, "driver", buf, sizeof (buf))) != NULL)
+		a->driver = strdup (p);
+
+	if ((attrs & PFP_ATTR_NUMA) != 0 &&
+	    (!read_int (s, PFP_FILE_NUMA, &a->numa) || a->numa < 0))
+		a->numa = -1;
+
+	if ((attrs & PFP_ATTR_IOMMU) != 0 &&
+	    ((p = read_link (s->dir, "iommu_group", buf, sizeof (buf))) == NULL ||
+	     sscanf (p, "%d", &a->iommu) != 1))
+		a->iommu = -1;
+
+	if ((attrs & PFP_ATTR_LINK) == 0)
+		return;
+
+	if (a->speed == NULL &&
+	    read_attr (s, PFP_FILE_SPEED, buf, sizeof (buf)) &&
+	    sscanf (buf, "%15[0-9.] GT/s", speed) == 1)
+		a->speed = strdup (speed);
+
+	if (!read_int (s, PFP_FILE_WIDTH, &a->width) || a->width <= 0)
+		a->width = -1;
+}
+
+void pfp_rule_fill_with (struct pfp_rule *o, const char *class, int attrs,
+			 const struct pfp_attr_files *files)
 {
-	char device[16];
+	const int links = PFP_ATTR_NAME | PFP_ATTR_DRIVER | PFP_ATTR_IOMMU;
+	struct source s = { -1, files };
 
-	if (o->name != NULL || o->slot.function > 8)
+	if (attrs == 0)
 		return;
 
-	snprintf (device, sizeof (device), "%04x:%02x:%02x.%o",
-		  o->slot.segment, o->slot.bus,
-		  o->slot.device,  o->slot.function);
+	/* links and class directories are never read in advance */
+	if ((files == NULL || (attrs & links) != 0) &&
+	    (s.dir = open_device (o)) < 0 && files == NULL)
+		return;
+
+	if ((attrs & PFP_ATTR_NAME) != 0 && o->name == NULL && s.dir >= 0)
+		o->name = get_device_name (s.dir, class);
 
-	o->name = get_device_name (class, device);
+	fill_attr (o, &s, attrs);
+
+	if (s.dir >= 0)
+		close (s.dir);
 }
 
-void pfp_rule_fill (struct pfp_rule *o, const char *class)
+void pfp_rule_fill (struct pfp_rule *o, const char *class, int attrs)
+{
+	pfp_rule_fill_with (o, class, attrs, NULL);
+}
+
+static const struct attr_name {
+	const char *name;
+	int attr;
+} attr_names[] = {
+	{ "name",	PFP_ATTR_NAME	},
+	{ "driver",	PFP_ATTR_DRIVER	},
+	{ "numa",	PFP_ATTR_NUMA	},
+	{ "iommu",	PFP_ATTR_IOMMU	},
+	{ "link",	PFP_ATTR_LINK	},
+	{ "all",	PFP_ATTR_ALL	},
+};
+
+int pfp_attr_parse (const char *list)
 {
-	pfp_rule_fill_name (o, class);
+	const size_t count = sizeof (attr_names) / sizeof (attr_names[0]);
+	int attrs = 0;
+	size_t i, len;
+
+	for (; *list != '\0'; list += len + (list[len] == ',')) {
+		len = strcspn (list, ",");
+
+		for (i = 0; i < count; ++i)
+			if (strlen (attr_names[i].name) == len &&
+			    strncmp (attr_names[i].name, list, len) == 0)
+				break;
+
+		if (i == count)
+			return -1;
+
+		attrs |= attr_names[i].attr;
+	}
+
+	return attrs;
 }
@@ -11,8 +11,6 @@
 
 #include "pfp-rule.h"
 
-extern int verbose;
-
 struct pfp_rule *pfp_rule_alloc (void)
 {
 	struct pfp_rule *o;
@@ -34,7 +32,15 @@ struct pfp_rule *pfp_rule_alloc (void)
 	o->device  = o->vendor  = -1;
 	o->sdevice = o->svendor = -1;
 
+	memset (&o->wild, 0, sizeof (o->wild));
+
 	o->name = NULL;
+
+	o->attr.driver = NULL;
+	o->attr.speed  = NULL;
+	o->attr.numa   = o->attr.iommu = o->attr.width = -1;
+
+	o->include = NULL;
 	return o;
 }
 
@@ -46,11 +52,96 @@ void pfp_rule_free (struct pfp_rule *o)
 		next = o->next;
 		free (o->path);
 		free (o->name);
+		free (o->attr.driver);
+		free (o->attr.speed);
+		free (o->include);
 		free (o);
 	}
 }
 
-size_t pfp_rule_count (struct pfp_rule *o)
+int pfp_root_segment (int segment, int bus)
+{
+	unsigned char s;
+
+	if (segment > 0 || bus == 0)  /* non-virtual segment */
+		return segment;
+
+	s = bus + (bus & 1);
+
+	return (bus      & 0x01) |
+	       ((s >> 6) & 0x02) |
+	       ((s >> 4) & 0x04) |
+	       ((s >> 2) & 0x08) |
+	       ((s >> 0) & 0x10) |
+	       ((s << 2) & 0x20) |
+	       ((s << 4) & 0x40) |
+	       ((s << 6) & 0x80);
+}
+
+static const
+struct pfp_rule *find_parent_rule (const struct pfp_rule *p, struct pfp_sbdf *o)
+{
+	for (; p != NULL; p = p->next)
+		if (p->slot.segment  == o->segment	&&
+		    p->slot.bus      == o->bus		&&
+		    p->slot.device   == o->device	&&
+		    p->slot.function == o->function)
+			return p;
+
+	return NULL;
+}
+
+static size_t write_segment (char *to, size_t avail, const struct pfp_rule *o)
+{
+	return snprintf (to, avail, "%x", o->segment);
+}
+
+static size_t write_path (char *to, size_t avail, const struct pfp_rule *o)
+{
+	size_t len;
+
+	if (o == NULL || o == o->up)
+		return snprintf (to, avail, "B");  /* buggy node */
+
+	len = (o->up == NULL) ?
+		write_segment (to, avail, o) :
+		write_path (to, avail, o->up);
+
+	to += len;
+	avail = avail > len ? avail - len: 0;
+
+	len += snprintf (to, avail, "/%x.%x", o->slot.device, o->slot.function);
+	return len;
+}
+
+static char *calc_path (const struct pfp_rule *o)
+{
+	size_t len = write_path (NULL, 0, o);
+	char *path;
+
+	if ((path = malloc (len + 1)) == NULL)
+		return path;
+
+	write_path (path, len + 1, o);
+	path[len] = '\0';
+	return path;
+}
+
+void pfp_rule_link (struct pfp_rule *o)
+{
+	struct pfp_rule *rule;
+
+	for (rule = o; rule != NULL; rule = rule->next)
+		if (rule->parent.segment >= 0)
+			rule->up = find_parent_rule (o, &rule->parent);
+
+	for (rule = o; rule != NULL; rule = rule->next) {
+		free (rule->path);
+		rule->path = calc_path (rule);
+	}
+}
+
+size_t pfp_rule_count (const struct pfp_rule *o)
 {
 	size_t count;
 
@@ -103,69 +194,6 @@ struct pfp_rule *pfp_rule_sort (struct pfp_rule *o)
 	return o;
 }
 
-static void show_sbdf (const struct pfp_sbdf *o, const char *prefix, FILE *to)
-{
-	if (o->segment < 0)
-		return;
-
-	fprintf (to, "%s\t= ", prefix);
-
-	if (o->segment != 0)
-		fprintf (to, "%x:%x:", o->segment, o->bus);
-	else if (o->bus != 0)
-		fprintf (to, "%x:", o->bus);
-
-	fprintf (to, "%x.%x\n", o->device, o->function);
-}
-
-static void show_id (int id, const char *prefix, FILE *to)
-{
-	if (id >= 0)
-		fprintf (to, "%s\t= %04x\n", prefix, id);
-}
-
-static void show_rule (struct pfp_rule *o, FILE *to)
-{
-	if (o->path != NULL) {
-		fprintf (to, "path\t= %s", o->path);
-
-		if (o->name != NULL)
-			fprintf (to, " (%s)", o->name);
-
-		fputc ('\n', to);
-	}
-
-	if (o->path == NULL || verbose > 0) {
-		show_sbdf (&o->parent, "parent", to);
-		show_sbdf (&o->slot, "slot", to);
-	}
-
-	if (o->interface >= 0)
-		fprintf (to, "class\t= %04x.%x\n", o->class, o->interface);
-	else
-		show_id (o->class, "class", to);
-
-	show_id (o->vendor, "vendor", to);
-	show_id (o->device, "device", to);
-
-	if ((o->svendor != 0 && o->svendor != 0xffff &&
-	     (o->svendor != o->vendor || o->sdevice != o->device)) ||
-	    verbose > 1) {
-		show_id (o->svendor, "svendor", to);
-		show_id (o->sdevice, "sdevice", to);
-	}
-}
-
-void pfp_rule_show (struct pfp_rule *o, FILE *to)
-{
-	for (; o != NULL; o = o->next) {
-		show_rule (o, to);
-
-		if (o->next != NULL)
-			fprintf (to, "\n");
-	}
-}
-
 static int slot_match (const struct pfp_sbdf *o, const struct pfp_sbdf *pattern)
 {
 	if (pattern->segment < 0)
@@ -177,12 +205,12 @@ static int slot_match (const struct pfp_sbdf *o, const struct pfp_sbdf *pattern)
 	       o->function == pattern->function;
 }
 
-static int id_match (int id, int pattern)
+static int id_match (int id, int pattern, int wild)
 {
 	if (pattern < 0)
 		return 1;
 
-	return id == pattern;
+	return ((id ^ pattern) & ~wild) == 0;
 }
 
 static int path_match (const struct pfp_rule *o, const struct pfp_rule *pattern)
@@ -197,13 +225,61 @@ static int path_match (const struct pfp_rule *o, const struct pfp_rule *pattern)
 
 static int rule_match (const struct pfp_rule *o, const struct pfp_rule *pattern)
 {
-	return path_match (o, pattern)				&&
-	       id_match (o->class,	pattern->class)		&&
-	       id_match (o->interface,	pattern->interface)	&&
-	       id_match (o->vendor,	pattern->vendor)	&&
-	       id_match (o->device,	pattern->device)	&&
-	       id_match (o->svendor,	pattern->svendor)	&&
-	       id_match (o->sdevice,	pattern->sdevice);
+	const struct pfp_wild *w = &pattern->wild;
+
+	return pattern->include == NULL					&&
+	       path_match (o, pattern)					&&
+	       id_match (o->class,     pattern->class,     w->class)	&&
+	       id_match (o->interface, pattern->interface, w->interface)	&&
+	       id_match (o->vendor,    pattern->vendor,    w->vendor)	&&
+	       id_match (o->device,    pattern->device,    w->device)	&&
+	       id_match (o->svendor,   pattern->svendor,   w->svendor)	&&
+	       id_match (o->sdevice,   pattern->sdevice,   w->sdevice);
+}
+
+int pfp_rule_test (const struct pfp_rule *o, const struct pfp_rule *pattern)
+{
+	return rule_match (o, pattern);
+}
+
+static int slot_overlap (const struct pfp_sbdf *a, const struct pfp_sbdf *b)
+{
+	return a->segment < 0 || b->segment < 0 || slot_match (a, b);
+}
+
+static int id_overlap (int a, int b, int wa, int wb)
+{
+	return a < 0 || b < 0 || ((a ^ b) & ~wa & ~wb) == 0;
+}
+
+/*
+ * Device with path is matched by path and device without one by slot,
+ * patterns with different paths may share only the latter.
+ */
+static int path_overlap (const struct pfp_rule *a, const struct pfp_rule *b)
+{
+	if ((a->path == NULL) != (b->path == NULL) ||
+	    (a->path != NULL && strcmp (a->path, b->path) == 0))
+		return 1;
+
+	return slot_overlap (&a->parent, &b->parent) &&
+	       slot_overlap (&a->slot,   &b->slot);
+}
+
+int pfp_rule_overlap (const struct pfp_rule *a, const struct pfp_rule *b)
+{
+	const struct pfp_wild *u = &a->wild, *v = &b->wild;
+
+	if (a->include != NULL || b->include != NULL || !path_overlap (a, b))
+		return 0;
+
+	return id_overlap (a->class,   b->class,   u->class,   v->class)   &&
+	       id_overlap (a->vendor,  b->vendor,  u->vendor,  v->vendor)  &&
+	       id_overlap (a->device,  b->device,  u->device,  v->device)  &&
+	       id_overlap (a->svendor, b->svendor, u->svendor, v->svendor) &&
+	       id_overlap (a->sdevice, b->sdevice, u->sdevice, v->sdevice) &&
+	       id_overlap (a->interface, b->interface,
+			   u->interface, v->interface);
 }
 
 const struct pfp_rule *
@@ -215,17 +291,3 @@ pfp_rule_search (const struct pfp_rule *o, const struct pfp_sbdf *slot)
 
 	return o;
 }
-
-/* return number of matches */
-size_t pfp_rule_match (const struct pfp_rule *o, const struct pfp_rule *pattern)
-{
-	const struct pfp_rule *p;
-	size_t count;
-
-	for (count = 0; o != NULL; o = o->next)
-		for (p = pattern; p != NULL; p = p->next)
-			if (rule_match (o, p))
-				++count;
-
-	return count;
-}
@@ -16,6 +16,21 @@ struct pfp_sbdf {
 	unsigned char bus, device, function;
 };
 
+/* don't care bits of identifier patterns, zero for exact match */
+struct pfp_wild {
+	int class, interface;
+	int vendor, device;
+	int svendor, sdevice;
+};
+
+/* extra device info collected from sysfs, not used for match */
+struct pfp_attr {
+	char *driver;		/* bound driver name */
+	char *speed;		/* PCIe link speed in GT/s, "8.0" */
+	int numa, iommu;	/* NUMA node and IOMMU group or -1 */
+	int width;		/* PCIe link width or -1 */
+};
+
 struct pfp_rule {
 	struct pfp_rule *next;
 	const struct pfp_rule *up;
@@ -27,26 +42,73 @@ struct pfp_rule {
 	int class, interface;
 	int vendor, device;
 	int svendor, sdevice;
+	struct pfp_wild wild;
 
 	char *name;
+	struct pfp_attr attr;
+
+	char *include;  /* shared rule block file, matches nothing itself */
 };
 
 struct pfp_rule *pfp_rule_alloc (void);
 void pfp_rule_free (struct pfp_rule *o);
 
-/* load extra info */
-void pfp_rule_fill (struct pfp_rule *o, const char *dev_class);
+enum pfp_attr_set {
+	PFP_ATTR_NAME	= 1,	/* class device names */
+	PFP_ATTR_DRIVER	= 2,
+	PFP_ATTR_NUMA	= 4,
+	PFP_ATTR_IOMMU	= 8,
+	PFP_ATTR_LINK	= 16,
+	PFP_ATTR_ALL	= 31,
+};
+
+/* parse comma-separated attribute names, returns -1 on error */
+int pfp_attr_parse (const char *list);
+
+/* load extra info selected by set of attributes */
+void pfp_rule_fill (struct pfp_rule *o, const char *dev_class, int attrs);
 
-size_t pfp_rule_count (struct pfp_rule *o);
+/*
+ * Plain attribute files of device directory may be read in advance by a
+ * batched reader: the name of the file is returned for every file needed
+ * by the set of attributes, NULL otherwise. Text of missing file has
+ * negative length.
+ */
+enum pfp_attr_file {
+	PFP_FILE_NUMA,
+	PFP_FILE_SPEED,
+	PFP_FILE_WIDTH,
+	PFP_FILE_COUNT,
+};
+
+struct pfp_attr_files {
+	int len[PFP_FILE_COUNT];
+	char text[PFP_FILE_COUNT][32];
+};
+
+const char *pfp_attr_file (int file, int attrs);
+
+void pfp_rule_fill_with (struct pfp_rule *o, const char *dev_class, int attrs,
+			 const struct pfp_attr_files *files);
+
+/* virtual segment number for a root bus of legacy segment zero */
+int pfp_root_segment (int segment, int bus);
+
+/* resolve parent rules and calculate topology paths */
+void pfp_rule_link (struct pfp_rule *o);
+
+size_t pfp_rule_count (const struct pfp_rule *o);
 struct pfp_rule *pfp_rule_sort (struct pfp_rule *o);
 
-void pfp_rule_show (struct pfp_rule *o, FILE *to);
+void pfp_rule_show (struct pfp_rule *o, FILE *to, int verbose);
 
 const struct pfp_rule *
 pfp_rule_search (const struct pfp_rule *o, const struct pfp_sbdf *slot);
 
-/* return number of matches */
-size_t
-pfp_rule_match (const struct pfp_rule *o, const struct pfp_rule *pattern);
+/* return non-zero if rule matches pattern */
+int pfp_rule_test (const struct pfp_rule *o, const struct pfp_rule *pattern);
+
+/* return non-zero if some device may match both patterns */
+int pfp_rule_overlap (const struct pfp_rule *a, const struct pfp_rule *b);
 
 #endif  /* PFP_RULE_H */
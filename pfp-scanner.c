@@ -6,12 +6,18 @@
  * SPDX-License-Identifier: BSD-2-Clause
  */
 
+#include <errno.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <pci/pci.h>
 
 #include "pfp-scanner.h"
+#include "pfp-uring.h"
 
 struct pci_bus {
 	struct pci_bus *next;
@@ -20,11 +26,48 @@ struct pci_bus {
 	struct pci_dev *devices;
 };
 
-static struct pci_bus *pci_bus_alloc (int segment, int bus)
+#define MAX_WORKERS  64
+#define MIN_JOBS     32  /* devices per worker to pay for a thread */
+
+#define CONFIG_SIZE  64  /* standard header, readable by anyone */
+#define RING_SIZE    256
+
+/* device data read in advance by batched reader */
+struct pci_info {
+	unsigned char config[CONFIG_SIZE];
+	int len;
+	struct pfp_attr_files files;
+};
+
+struct pci_catch {
+	jmp_buf fatal;
+	char error[128];
+};
+
+struct pfp_scanner {
+	struct pci_access *pacc;
+	struct pci_bus *list, *spare;  /* buses seen and nodes to reuse */
+	struct pfp_rule *head;
+	struct pci_catch catch;
+	int workers;
+	struct pci_dev **devs;  /* device table reused between scans */
+	struct pfp_rule **rules;
+	size_t avail;
+	int batch;
+	struct pfp_uring *ring;
+	struct pci_info *info;
+	struct pfp_read *reads;
+	size_t info_avail, reads_avail;
+};
+
+static struct pci_bus *
+pci_bus_alloc (struct pfp_scanner *s, int segment, int bus)
 {
 	struct pci_bus *o;
 
-	if ((o = malloc (sizeof (*o))) == NULL)
+	if ((o = s->spare) != NULL)
+		s->spare = o->next;
+	else if ((o = malloc (sizeof (*o))) == NULL)
 		return NULL;
 
 	o->next		= NULL;
@@ -35,19 +78,18 @@ static struct pci_bus *pci_bus_alloc (int segment, int bus)
 	return o;
 }
 
-static void pci_bus_free (struct pci_bus *o)
+/* drop devices and keep bus node for the next scan */
+static void pci_bus_free (struct pfp_scanner *s, struct pci_bus *o)
 {
 	struct pci_dev *p, *next;
 
-	if (o == NULL)
-		return;
-
 	for (p = o->devices; p != NULL; p = next) {
 		next = p->next;
 		pci_free_dev (p);
 	}
 
-	free (o);
+	o->next  = s->spare;
+	s->spare = o;
 }
 
 static void pci_bus_add (struct pci_bus *o, struct pci_dev *p)
@@ -56,13 +98,8 @@ static void pci_bus_add (struct pci_bus *o, struct pci_dev *p)
 	o->devices = p;
 }
 
-struct pci_state {
-	struct pci_access *pacc;
-	struct pci_bus *list;
-};
-
 static struct pci_bus *
-pci_state_find (struct pci_state *o, int segment, int bus, int alloc)
+pci_state_find (struct pfp_scanner *o, int segment, int bus, int alloc)
 {
 	struct pci_bus *p;
 
@@ -70,7 +107,7 @@ pci_state_find (struct pci_state *o, int segment, int bus, int alloc)
 		if (p->segment == segment && p->bus == bus)
 			return p;
 
-	if (!alloc || (p = pci_bus_alloc (segment, bus)) == NULL)
+	if (!alloc || (p = pci_bus_alloc (o, segment, bus)) == NULL)
 		return NULL;
 
 	p->next = o->list;
@@ -78,7 +115,7 @@ pci_state_find (struct pci_state *o, int segment, int bus, int alloc)
 	return p;
 }
 
-static int pci_state_add (struct pci_state *o, struct pci_dev *p)
+static int pci_state_add (struct pfp_scanner *o, struct pci_dev *p)
 {
 	struct pci_bus *bus;
 	int i;
@@ -109,38 +146,161 @@ static int pci_state_add (struct pci_state *o, struct pci_dev *p)
 
 static void recalc_segment (struct pci_bus *o)
 {
-	unsigned char s;
-
 	if (o->root.segment >= 0)  /* not a root bridge */
 		return;
 
-	if (o->segment > 0 || o->bus == 0)  /* non-virtual segment */
-		return;
+	o->segment = pfp_root_segment (o->segment, o->bus);
+}
 
-	s = o->bus + (o->bus & 1);
+/*
+ * libpci reports fatal errors through the error callback which must
+ * not return: unwind back to the scanner call instead of exit
+ */
+static __thread struct pci_catch *current;
 
-	o->segment = (o->bus   & 0x01) |
-		     ((s >> 6) & 0x02) |
-		     ((s >> 4) & 0x04) |
-		     ((s >> 2) & 0x08) |
-		     ((s >> 0) & 0x10) |
-		     ((s << 2) & 0x20) |
-		     ((s << 4) & 0x40) |
-		     ((s << 6) & 0x80);
-}
+static void pci_fatal (char *msg, ...) __attribute__ ((noreturn));
 
-static int pci_state_init (struct pci_state *s)
+static void pci_fatal (char *msg, ...)
 {
-	struct pci_dev *p;
-	struct pci_bus *bus;
+	va_list ap;
+
+	va_start (ap, msg);
+	vsnprintf (current->error, sizeof (current->error), msg, ap);
+	va_end (ap);
 
+	longjmp (current->fatal, 1);
+}
+
+static int pci_state_open (struct pfp_scanner *s)
+{
 	if ((s->pacc = pci_alloc ()) == NULL)
 		return 0;
 
+	s->pacc->error = pci_fatal;
 	pci_init (s->pacc);
-	pci_scan_bus (s->pacc);
+	return 1;
+}
+
+static int preload_grow (struct pfp_scanner *s, size_t count, size_t files)
+{
+	struct pci_info *info;
+	struct pfp_read *reads;
+
+	if (count > s->info_avail) {
+		if ((info = realloc (s->info, sizeof (info[0]) * count)) == NULL)
+			return 0;
+
+		s->info       = info;
+		s->info_avail = count;
+	}
+
+	if (count * files > s->reads_avail) {
+		reads = realloc (s->reads, sizeof (reads[0]) * count * files);
+
+		if (reads == NULL)
+			return 0;
+
+		s->reads       = reads;
+		s->reads_avail = count * files;
+	}
+
+	return 1;
+}
+
+static void preload_add (struct pfp_read *r, const struct pci_dev *p,
+			 const char *name, void *buf, unsigned size)
+{
+	snprintf (r->path, sizeof (r->path),
+		  "/sys/bus/pci/devices/%04x:%02x:%02x.%d/%s",
+		  p->domain, p->bus, p->dev, p->func, name);
+
+	r->buf  = buf;
+	r->size = size;
+}
+
+static void preload_cache (struct pci_dev *p, const struct pci_info *info)
+{
+	if (info != NULL && info->len > 0)
+		pci_setup_cache (p, (void *) info->config, info->len);
+}
+
+/*
+ * Config space headers and plain attribute files of all the devices are
+ * read at once with io_uring if enabled, config space is given to libpci
+ * as the device cache. This is done for sysfs access method only, thus
+ * the data are the same as read by libpci itself. If io_uring is not
+ * available nothing is preloaded and devices are read one by one.
+ */
+static void pci_state_preload (struct pfp_scanner *s, int attrs)
+{
+	struct pci_dev *p;
+	struct pci_info *info;
+	struct pfp_read *r;
+	size_t count = 0, files = 1;
+	int f;
+
+	if (!s->batch || s->pacc->method != PCI_ACCESS_SYS_BUS_PCI)
+		return;
+
+	if (s->ring == NULL && (s->ring = pfp_uring_alloc (RING_SIZE)) == NULL)
+		goto no_ring;
+
+	for (p = s->pacc->devices; p != NULL; p = p->next)
+		++count;
+
+	for (f = 0; f < PFP_FILE_COUNT; ++f)
+		files += pfp_attr_file (f, attrs) != NULL;
+
+	if (count == 0 || !preload_grow (s, count, files))
+		return;
+
+	for (r = s->reads, info = s->info, p = s->pacc->devices; p != NULL;
+	     p = p->next, ++info) {
+		preload_add (r++, p, "config", info->config, CONFIG_SIZE);
+
+		for (f = 0; f < PFP_FILE_COUNT; ++f)
+			if (pfp_attr_file (f, attrs) != NULL)
+				preload_add (r++, p, pfp_attr_file (f, attrs),
+					     info->files.text[f],
+					     sizeof (info->files.text[f]) - 1);
+	}
+
+	if (!pfp_uring_read (s->ring, s->reads, count * files))
+		goto no_read;
+
+	for (r = s->reads, info = s->info, p = s->pacc->devices; p != NULL;
+	     p = p->next, ++info) {
+		info->len = r++->len;
+		preload_cache (p, info);
+
+		for (f = 0; f < PFP_FILE_COUNT; ++f) {
+			info->files.len[f] = -1;
 
-	s->list = NULL;
+			if (pfp_attr_file (f, attrs) == NULL ||
+			    (info->files.len[f] = r++->len) < 0)
+				continue;
+
+			info->files.text[f][info->files.len[f]] = '\0';
+		}
+
+		p->aux = info;
+	}
+
+	return;
+no_read:
+	pfp_uring_free (s->ring);
+	s->ring = NULL;
+no_ring:
+	s->batch = 0;  /* fall back to plain reads for good */
+}
+
+static void pci_state_scan (struct pfp_scanner *s, int attrs)
+{
+	struct pci_dev *p;
+	struct pci_bus *bus;
+
+	pci_scan_bus (s->pacc);
+	pci_state_preload (s, attrs);
 
 	for (p = s->pacc->devices; p != NULL; p = s->pacc->devices) {
 		s->pacc->devices = p->next;  /* cut device */
@@ -149,24 +309,23 @@ static int pci_state_init (struct pci_state *s)
 
 	for (bus = s->list; bus != NULL; bus = bus->next)
 		recalc_segment (bus);
-
-	return 1;
 }
 
-static void pci_state_fini (struct pci_state *o)
+static void pci_state_fini (struct pfp_scanner *o)
 {
 	struct pci_bus *p, *next;
 
 	for (p = o->list; p != NULL; p = next) {
 		next = p->next;
-		pci_bus_free (p);
+		pci_bus_free (o, p);
 	}
 
-	pci_cleanup (o->pacc);
+	o->list = NULL;
 }
 
 static struct pfp_rule *
-pci_rule_alloc (struct pci_dev *dev, int verbose, const char *class)
+pci_rule_alloc (struct pci_dev *dev, int attrs, const char *class,
+		const struct pci_info *info)
 {
 	struct pfp_rule *o;
 	int v;
@@ -196,76 +355,293 @@ pci_rule_alloc (struct pci_dev *dev, int verbose, const char *class)
 		o->sdevice = pci_read_word (dev, PCI_SUBSYSTEM_ID);
 	}
 
-	if (verbose)
-		pfp_rule_fill (o, class);
+	if (attrs != 0)
+		pfp_rule_fill_with (o, class, attrs,
+				    info != NULL ? &info->files : NULL);
 
 	return o;
 }
 
-static const
-struct pfp_rule *find_parent_rule (const struct pfp_rule *p, struct pfp_sbdf *o)
+struct pfp_scanner *pfp_scanner_alloc (void)
 {
-	for (; p != NULL; p = p->next)
-		if (p->slot.segment  == o->segment	&&
-		    p->slot.bus      == o->bus		&&
-		    p->slot.device   == o->device	&&
-		    p->slot.function == o->function)
-			return p;
+	struct pfp_scanner *o;
 
-	return NULL;
+	if ((o = malloc (sizeof (*o))) == NULL)
+		return NULL;
+
+	o->pacc     = NULL;
+	o->list     = NULL;
+	o->spare    = NULL;
+	o->head     = NULL;
+	o->workers  = 1;
+	o->devs     = NULL;
+	o->rules    = NULL;
+	o->avail    = 0;
+	o->batch    = 0;
+	o->ring     = NULL;
+	o->info     = NULL;
+	o->reads    = NULL;
+
+	o->info_avail  = 0;
+	o->reads_avail = 0;
+
+	o->catch.error[0] = '\0';
+	return o;
 }
 
-static size_t write_segment (char *to, size_t avail, const struct pfp_rule *o)
+void pfp_scanner_free (struct pfp_scanner *o)
 {
-	return snprintf (to, avail, "%x", o->segment);
+	struct pci_bus *p, *next;
+
+	if (o == NULL)
+		return;
+
+	pci_state_fini (o);
+
+	for (p = o->spare; p != NULL; p = next) {
+		next = p->next;
+		free (p);
+	}
+
+	if (o->pacc != NULL)
+		pci_cleanup (o->pacc);
+
+	pfp_uring_free (o->ring);
+	free (o->devs);
+	free (o->rules);
+	free (o->info);
+	free (o->reads);
+	free (o);
+}
+
+void pfp_scanner_workers (struct pfp_scanner *o, int workers)
+{
+	o->workers = workers < 1 ? 1 : workers > MAX_WORKERS ? MAX_WORKERS :
+		     workers;
+}
+
+void pfp_scanner_batch (struct pfp_scanner *o, int enable)
+{
+	o->batch = enable;
 }
 
-static size_t write_path (char *to, size_t avail, const struct pfp_rule *o)
+/*
+ * Device table in bus walk order: rules are filled in parallel into the
+ * slots of the same index, thus the result order does not depend on
+ * scheduling.
+ */
+static int scanner_table (struct pfp_scanner *o, size_t *size)
 {
-	size_t len;
+	struct pci_bus *bus;
+	struct pci_dev *p, **devs;
+	struct pfp_rule **rules;
+	size_t count = 0;
+
+	for (bus = o->list; bus != NULL; bus = bus->next)
+		for (p = bus->devices; p != NULL; p = p->next)
+			++count;
+
+	if (count > o->avail) {
+		if ((devs = realloc (o->devs, sizeof (devs[0]) * count)) == NULL)
+			return 0;
+
+		o->devs = devs;
+
+		if ((rules = realloc (o->rules, sizeof (rules[0]) * count)) == NULL)
+			return 0;
+
+		o->rules = rules;
+		o->avail = count;
+	}
+
+	count = 0;
+
+	for (bus = o->list; bus != NULL; bus = bus->next)
+		for (p = bus->devices; p != NULL; p = p->next) {
+			o->devs[count]  = p;
+			o->rules[count] = NULL;
+			++count;
+		}
 
-	if (o == NULL || o == o->up)
-		return snprintf (to, avail, "B");  /* buggy node */
+	*size = count;
+	return 1;
+}
 
-	len = (o->up == NULL) ?
-		write_segment (to, avail, o) :
-		write_path (to, avail, o->up);
+struct pool {
+	struct pfp_scanner *scanner;
+	size_t count, next;
+	int attrs, failed;
+	const char *class;
+	pthread_mutex_t lock;
+};
 
-	to += len;
-	avail = avail > len ? avail - len: 0;
+static size_t pool_get (struct pool *o)
+{
+	size_t i;
 
-	len += snprintf (to, avail, "/%x.%x", o->slot.device, o->slot.function);
-	return len;
+	pthread_mutex_lock (&o->lock);
+	i = o->failed ? o->count : o->next < o->count ? o->next++ : o->count;
+	pthread_mutex_unlock (&o->lock);
+	return i;
 }
 
-static char *calc_path (const struct pfp_rule *o)
+/* failed is 1 on allocation failure and 2 on fatal access error */
+static void pool_fail (struct pool *o, const char *error)
 {
-	size_t len = write_path (NULL, 0, o);
-	char *path;
+	struct pci_catch *c = &o->scanner->catch;
 
-	if ((path = malloc (len + 1)) == NULL)
-		return path;
+	pthread_mutex_lock (&o->lock);
+
+	if (error == NULL) {
+		if (o->failed == 0)
+			o->failed = 1;
+	}
+	else if (o->failed < 2) {
+		snprintf (c->error, sizeof (c->error), "%s", error);
+		o->failed = 2;
+	}
 
-	write_path (path, len + 1, o);
-	path[len] = '\0';
-	return path;
+	pthread_mutex_unlock (&o->lock);
 }
 
-struct pfp_rule *pfp_scan (int verbose, const char *class)
+/*
+ * Config space of a device read through the same access object from
+ * several threads is not safe: additional workers open own access and
+ * look devices up by address, the calling thread uses scanned devices.
+ * Fatal access error of a worker stops the pool.
+ */
+static void pool_work (struct pool *o, int own)
+{
+	struct pfp_scanner *s = o->scanner;
+	struct pci_access *volatile pacc = NULL;
+	struct pci_dev *volatile dev = NULL;
+	struct pci_dev *p;
+	struct pci_catch c;
+	size_t i;
+
+	current = &c;
+
+	if (setjmp (c.fatal) != 0) {
+		pool_fail (o, c.error);
+		goto out;
+	}
+
+	if (own) {
+		if ((pacc = pci_alloc ()) == NULL)
+			goto no_access;
+
+		pacc->error = pci_fatal;
+		pci_init (pacc);
+	}
+
+	while ((i = pool_get (o)) < o->count) {
+		p = s->devs[i];
+
+		if (own) {
+			dev = pci_get_dev (pacc, p->domain, p->bus, p->dev,
+					   p->func);
+			if (dev == NULL)
+				goto no_access;
+
+			preload_cache (dev, p->aux);
+		}
+
+		s->rules[i] = pci_rule_alloc (own ? dev : p, o->attrs, o->class,
+					      p->aux);
+
+		if (own) {
+			pci_free_dev (dev);
+			dev = NULL;
+		}
+
+		if (s->rules[i] == NULL)
+			goto no_access;
+	}
+out:
+	if (dev != NULL)
+		pci_free_dev (dev);
+
+	if (pacc != NULL)
+		pci_cleanup (pacc);
+
+	return;
+no_access:
+	pool_fail (o, NULL);
+	goto out;
+}
+
+static void *worker (void *cookie)
+{
+	pool_work (cookie, 1);
+	return NULL;
+}
+
+static int pool_run (struct pfp_scanner *s, size_t count, int attrs,
+		     const char *class)
+{
+	const size_t limit = count / MIN_JOBS + 1;
+	int workers = s->workers, i, n;
+	struct pool o;
+	pthread_t t[MAX_WORKERS];
+	size_t j;
+
+	if ((size_t) workers > limit)
+		workers = limit;
+
+	o.scanner = s;
+	o.count   = count;
+	o.next    = 0;
+	o.attrs   = attrs;
+	o.failed  = 0;
+	o.class   = class;
+
+	pthread_mutex_init (&o.lock, NULL);
+
+	for (n = 0; n < workers - 1; ++n)
+		if (pthread_create (t + n, NULL, worker, &o) != 0)
+			break;
+
+	pool_work (&o, 0);  /* use current thread as well */
+
+	for (i = 0; i < n; ++i)
+		pthread_join (t[i], NULL);
+
+	pthread_mutex_destroy (&o.lock);
+	current = &s->catch;
+
+	if (o.failed == 0)
+		return 1;
+
+	for (j = 0; j < count; ++j)
+		pfp_rule_free (s->rules[j]);
+
+	if (o.failed > 1)
+		longjmp (s->catch.fatal, 1);
+
+	return 0;
+}
+
+static struct pfp_rule *
+scanner_run (struct pfp_scanner *o, int attrs, const char *class)
 {
-	struct pci_state s;
 	struct pci_bus *bus;
 	struct pci_dev *p;
+	struct pfp_rule **tail = &o->head, *rule;
+	size_t count, i;
 
-	struct pfp_rule *head = NULL, **tail = &head, *rule;
+	if (o->pacc == NULL && !pci_state_open (o))
+		return NULL;
+
+	pci_state_scan (o, attrs);
 
-	if (!pci_state_init (&s))
+	if (!scanner_table (o, &count) || !pool_run (o, count, attrs, class))
 		return NULL;
 
-	for (bus = s.list; bus != NULL; bus = bus->next)
+	i = 0;
+
+	for (bus = o->list; bus != NULL; bus = bus->next)
 		for (p = bus->devices; p != NULL; p = p->next) {
-			if ((rule = pci_rule_alloc (p, verbose, class)) == NULL)
-				goto error;
+			rule = o->rules[i++];
 
 			*tail = rule;
 			tail = &rule->next;
@@ -281,17 +657,57 @@ struct pfp_rule *pfp_scan (int verbose, const char *class)
 			rule->parent.function = bus->root.function;
 		}
 
-	for (rule = head; rule != NULL; rule = rule->next)
-		if (rule->parent.segment >= 0)
-			rule->up = find_parent_rule (head, &rule->parent);
+	pfp_rule_link (o->head);
+	return o->head;
+}
 
-	for (rule = head; rule != NULL; rule = rule->next)
-		rule->path = calc_path (rule);
+struct pfp_rule *
+pfp_scanner_run (struct pfp_scanner *o, int attrs, const char *class)
+{
+	struct pfp_rule *r;
+
+	o->head = NULL;
+	o->catch.error[0] = '\0';
+	current = &o->catch;
+
+	if (setjmp (o->catch.fatal) != 0) {
+		/* access state is unknown after failure: reopen next time */
+		pci_state_fini (o);
+		pci_cleanup (o->pacc);
+		o->pacc = NULL;
+		errno = EIO;
+		goto error;
+	}
 
-	pci_state_fini (&s);
-	return head;
+	if ((r = scanner_run (o, attrs, class)) == NULL)
+		goto error;
+
+	pci_state_fini (o);
+	o->head = NULL;
+	return r;
 error:
-	pci_state_fini (&s);
-	pfp_rule_free (head);
+	pci_state_fini (o);
+	pfp_rule_free (o->head);
+	o->head = NULL;
 	return NULL;
 }
+
+const char *pfp_scanner_error (struct pfp_scanner *o)
+{
+	return o->catch.error[0] != '\0' ? o->catch.error : NULL;
+}
+
+/* all in one */
+struct pfp_rule *pfp_scan (int attrs, const char *class)
+{
+	struct pfp_scanner *s;
+	struct pfp_rule *r;
+
+	if ((s = pfp_scanner_alloc ()) == NULL)
+		return NULL;
+
+	r = pfp_scanner_run (s, attrs, class);
+
+	pfp_scanner_free (s);
+	return r;
+}
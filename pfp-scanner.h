@@ -11,6 +11,34 @@
 
 #include "pfp-rule.h"
 
-struct pfp_rule *pfp_scan (int verbose, const char *dev_class);
+/*
+ * Scanner keeps PCI access method open between runs, thus rescan costs
+ * just a bus walk. Returns NULL with errno set on failure, the reason
+ * reported by access method available with pfp_scanner_error. Extra
+ * device info selected by a set of PFP_ATTR_* flags is loaded for every
+ * device, class limits device names to the given device class.
+ */
+struct pfp_scanner *pfp_scanner_alloc (void);
+void pfp_scanner_free (struct pfp_scanner *o);
+
+struct pfp_rule *
+pfp_scanner_run (struct pfp_scanner *o, int attrs, const char *dev_class);
+const char *pfp_scanner_error (struct pfp_scanner *o);
+
+/*
+ * Device info is read and filled by a pool of up to the given number of
+ * threads (one by default), bus topology is walked by the caller.
+ */
+void pfp_scanner_workers (struct pfp_scanner *o, int workers);
+
+/*
+ * Read config space headers and attribute files of all the devices at
+ * once with io_uring (disabled by default). Scan result is the same, if
+ * io_uring is not available devices are read one by one as usual.
+ */
+void pfp_scanner_batch (struct pfp_scanner *o, int enable);
+
+/* all in one */
+struct pfp_rule *pfp_scan (int attrs, const char *dev_class);
 
 #endif  /* PFP_SCANNER_H */
@@ -0,0 +1,290 @@
+/*
+ * PCI Finger-Print Sysfs Topology Lookup
+ *
+ * Copyright (c) 2016-2024 Alexei A. Smekalkine <ikle@ikle.ru>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "pfp-sysfs.h"
+
+#define SYSFS_DEVICES	"/sys/devices"
+#define PCI_DEVICES	"/sys/bus/pci/devices"
+#define PCI_BUSES	"/sys/class/pci_bus"
+#define SECONDARY_BUS	0x19
+
+static int get_root (const char *s, unsigned *segment, unsigned *bus)
+{
+	int n;
+
+	return sscanf (s, "pci%x:%x%n", segment, bus, &n) == 2 && s[n] == '\0';
+}
+
+static int get_device (const char *s, unsigned *segment, unsigned *bus,
+		       unsigned *device, unsigned *function)
+{
+	int n;
+
+	return sscanf (s, "%x:%x:%x.%x%n", segment, bus, device, function,
+		       &n) == 4 && s[n] == '\0';
+}
+
+static int read_secondary (int dir, const char *path, unsigned *bus)
+{
+	int fd;
+	unsigned char x;
+	ssize_t len;
+
+	if ((fd = openat (dir, path, O_RDONLY | O_CLOEXEC)) < 0)
+		return 0;
+
+	len = pread (fd, &x, 1, SECONDARY_BUS);
+	close (fd);
+
+	if (len != 1) {
+		errno = EIO;
+		return 0;
+	}
+
+	*bus = x;
+	return 1;
+}
+
+/* secondary bus of bridge by its device name */
+static int bridge_secondary (const char *bridge, unsigned *bus)
+{
+	char path[sizeof (PCI_DEVICES) + PATH_MAX + 8];
+
+	snprintf (path, sizeof (path), PCI_DEVICES "/%s/config", bridge);
+	return read_secondary (AT_FDCWD, path, bus);
+}
+
+/*
+ * Device link points to device directory under its root bus directory
+ * with all the bridges above the device in between:
+ *
+ *	../../../devices/pci0000:00/0000:00:1c.0/0000:02:00.0
+ *
+ * Root bus directory may be nested (VMD domain, for example), the path
+ * starts from the last one as the scanner sees a separate root bus there.
+ * Device is a child of the bridge above only if it is on the secondary
+ * bus of the bridge: SR-IOV virtual functions on a bus of their own are
+ * kept in the directory of the bridge above their physical function, but
+ * the scanner sees a root bus there as no bridge leads to it.
+ */
+char *pfp_sysfs_path (const struct pfp_sbdf *slot)
+{
+	char name[64], link[PATH_MAX], *p, *next, *up = NULL, *path;
+	ssize_t len;
+	size_t size, pos = 0;
+	unsigned segment, bus, device, function, secondary;
+	int root = 0;
+
+	snprintf (name, sizeof (name), PCI_DEVICES "/%04x:%02x:%02x.%o",
+		  slot->segment, slot->bus, slot->device, slot->function);
+
+	if ((len = readlink (name, link, sizeof (link) - 1)) < 0)
+		return NULL;
+
+	link[len] = '\0';
+	size = len + 16;  /* path is never longer than link */
+
+	if ((path = malloc (size)) == NULL)
+		return NULL;
+
+	for (p = strtok_r (link, "/", &next); p != NULL;
+	     p = strtok_r (NULL, "/", &next))
+		if (get_root (p, &segment, &bus))
+			root = 1, pos = 0, up = NULL;
+		else if (root &&
+			 get_device (p, &segment, &bus, &device, &function)) {
+			if (up != NULL) {
+				if (!bridge_secondary (up, &secondary))
+					goto no_bridge;
+
+				if (secondary != bus)
+					pos = 0;
+			}
+
+			if (pos == 0)
+				pos = snprintf (path, size, "%x",
+						pfp_root_segment (segment, bus));
+
+			pos += snprintf (path + pos, size - pos, "/%x.%x",
+					 device, function);
+			up = p;
+		}
+
+	if (pos == 0) {
+		free (path);
+		errno = ENODEV;
+		return NULL;
+	}
+
+	return path;
+no_bridge:
+	free (path);
+	return NULL;
+}
+
+/* root bus directory at the top of sysfs devices, the lowest one */
+static int find_top_root (unsigned seg, unsigned *segment, unsigned *bus,
+			  char *root, size_t size)
+{
+	DIR *d;
+	struct dirent *e;
+	unsigned s, b;
+	int found = 0;
+
+	if ((d = opendir (SYSFS_DEVICES)) == NULL)
+		return 0;
+
+	while ((e = readdir (d)) != NULL)
+		if (get_root (e->d_name, &s, &b) &&
+		    (unsigned) pfp_root_segment (s, b) == seg &&
+		    (!found || s < *segment || (s == *segment && b < *bus))) {
+			*segment = s;
+			*bus     = b;
+			found    = 1;
+		}
+
+	closedir (d);
+
+	if (found)
+		snprintf (root, size, SYSFS_DEVICES "/pci%04x:%02x",
+			  *segment, *bus);
+
+	return found;
+}
+
+/*
+ * Nested root bus is a bus no bridge has as its secondary one. Device
+ * link of the bus names either its host bridge directory (VMD domain)
+ * or the bridge above (virtual bus of SR-IOV functions), devices of the
+ * bus are kept in that directory.
+ */
+static int find_nested_root (unsigned seg, unsigned *segment, unsigned *bus,
+			     char *root, size_t size)
+{
+	DIR *d;
+	struct dirent *e;
+	char name[sizeof (PCI_BUSES) + NAME_MAX + 16], link[PATH_MAX], *p;
+	ssize_t len;
+	unsigned s, b, x, y;
+	int n, found = 0;
+
+	if ((d = opendir (PCI_BUSES)) == NULL)
+		return 0;
+
+	while ((e = readdir (d)) != NULL) {
+		if (sscanf (e->d_name, "%x:%x%n", &s, &b, &n) != 2 ||
+		    e->d_name[n] != '\0' ||
+		    (unsigned) pfp_root_segment (s, b) != seg ||
+		    (found && (s > *segment || (s == *segment && b >= *bus))))
+			continue;
+
+		snprintf (name, sizeof (name), PCI_BUSES "/%s/device",
+			  e->d_name);
+
+		if ((len = readlink (name, link, sizeof (link) - 1)) < 0)
+			continue;
+
+		link[len] = '\0';
+		p = (p = strrchr (link, '/')) != NULL ? p + 1 : link;
+
+		if (!get_root (p, &x, &y) &&
+		    (!bridge_secondary (p, &x) || x == b))
+			continue;
+
+		snprintf (root, size, "%s", name);
+		*segment = s;
+		*bus     = b;
+		found    = 1;
+	}
+
+	closedir (d);
+	return found;
+}
+
+/*
+ * Find root bus by its (virtual) segment, the lowest one if ambiguous:
+ * top level root buses are looked at first, only a few buses are there,
+ * nested ones are looked for bus by bus then.
+ */
+static int find_root (unsigned seg, unsigned *segment, unsigned *bus,
+		      char *root, size_t size)
+{
+	if (find_top_root (seg, segment, bus, root, size) ||
+	    find_nested_root (seg, segment, bus, root, size))
+		return 1;
+
+	errno = ENODEV;
+	return 0;
+}
+
+/*
+ * Every step opens child directory of current device: secondary bus
+ * number of the bridge gives the child name, as the scanner links them.
+ */
+int pfp_sysfs_slot (const char *path, struct pfp_sbdf *slot)
+{
+	char root[sizeof (PCI_DEVICES) + PATH_MAX], name[64];
+	unsigned seg, segment = 0, bus = 0, device, function;
+	int n, dir, next, depth = 0;
+
+	if (sscanf (path, "%x%n", &seg, &n) != 1)
+		goto no_format;
+
+	if (!find_root (seg, &segment, &bus, root, sizeof (root)))
+		return 0;
+
+	if ((dir = open (root, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+		return 0;
+
+	for (path += n; *path != '\0'; path += n, ++depth) {
+		if (sscanf (path, "/%x.%x%n", &device, &function, &n) != 2 ||
+		    device > 0x1f || function > 7)
+			goto no_path;
+
+		if (depth > 0 && !read_secondary (dir, "config", &bus))
+			goto no_device;
+
+		snprintf (name, sizeof (name), "%04x:%02x:%02x.%x",
+			  segment, bus, device, function);
+
+		next = openat (dir, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		close (dir);
+
+		if ((dir = next) < 0)
+			return 0;
+	}
+
+	close (dir);
+
+	if (depth == 0)
+		goto no_format;
+
+	slot->segment  = segment;
+	slot->bus      = bus;
+	slot->device   = device;
+	slot->function = function;
+	return 1;
+no_path:
+	close (dir);
+no_format:
+	errno = EINVAL;
+	return 0;
+no_device:
+	close (dir);
+	return 0;
+}
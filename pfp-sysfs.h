@@ -0,0 +1,27 @@
+/*
+ * PCI Finger-Print Sysfs Topology Lookup
+ *
+ * Copyright (c) 2016-2024 Alexei A. Smekalkine <ikle@ikle.ru>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef PFP_SYSFS_H
+#define PFP_SYSFS_H  1
+
+#include "pfp-rule.h"
+
+/*
+ * Topology path of one device taken from its sysfs device link, the same
+ * as the scanner calculates, without a bus scan. Returns NULL with errno
+ * set on failure.
+ */
+char *pfp_sysfs_path (const struct pfp_sbdf *slot);
+
+/*
+ * Reverse lookup: find device by topology path descending from the root
+ * bus bridge by bridge. Returns zero with errno set on failure.
+ */
+int pfp_sysfs_slot (const char *path, struct pfp_sbdf *slot);
+
+#endif  /* PFP_SYSFS_H */
@@ -0,0 +1,371 @@
+/*
+ * PCI Finger-Print Batched File Reader
+ *
+ * Copyright (c) 2016-2024 Alexei A. Smekalkine <ikle@ikle.ru>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "pfp-uring.h"
+
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+#endif
+
+/* open, read and close operations are in kernel headers since 5.6 */
+#if defined (__NR_io_uring_setup) && defined (IORING_FEAT_RW_CUR_POS)
+
+struct pfp_uring {
+	int fd;
+	unsigned entries, tail;
+
+	void *sq_ring, *cq_ring;
+	size_t sq_size, cq_size;
+	unsigned *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+};
+
+static int probe_ops (int fd)
+{
+	static const int ops[] = {
+		IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE,
+	};
+	const size_t count = 256;
+	struct io_uring_probe *p;
+	size_t i;
+	int ok;
+
+	if ((p = calloc (1, sizeof (*p) + sizeof (p->ops[0]) * count)) == NULL)
+		return 0;
+
+	ok = syscall (__NR_io_uring_register, fd, IORING_REGISTER_PROBE,
+		      p, count) == 0;
+
+	for (i = 0; ok && i < sizeof (ops) / sizeof (ops[0]); ++i)
+		ok = ops[i] <= p->last_op &&
+		     (p->ops[ops[i]].flags & IO_URING_OP_SUPPORTED) != 0;
+
+	free (p);
+
+	if (!ok)
+		errno = ENOSYS;
+
+	return ok;
+}
+
+struct pfp_uring *pfp_uring_alloc (unsigned entries)
+{
+	struct pfp_uring *o;
+	struct io_uring_params p;
+	void *sq, *cq;
+
+	if ((o = malloc (sizeof (*o))) == NULL)
+		return NULL;
+
+	memset (&p, 0, sizeof (p));
+
+	if ((o->fd = syscall (__NR_io_uring_setup, entries, &p)) < 0)
+		goto no_ring;
+
+	if (!probe_ops (o->fd))
+		goto no_probe;
+
+	o->entries = p.sq_entries;
+	o->sq_size = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+	o->cq_size = p.cq_off.cqes  + p.cq_entries * sizeof (o->cqes[0]);
+
+	if ((p.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+		if (o->cq_size > o->sq_size)
+			o->sq_size = o->cq_size;
+
+		o->cq_size = 0;
+	}
+
+	sq = mmap (NULL, o->sq_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, o->fd, IORING_OFF_SQ_RING);
+
+	if (sq == MAP_FAILED)
+		goto no_sq;
+
+	cq = o->cq_size == 0 ? sq :
+	     mmap (NULL, o->cq_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, o->fd, IORING_OFF_CQ_RING);
+
+	if (cq == MAP_FAILED)
+		goto no_cq;
+
+	o->sqes = mmap (NULL, p.sq_entries * sizeof (o->sqes[0]),
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			o->fd, IORING_OFF_SQES);
+
+	if (o->sqes == MAP_FAILED)
+		goto no_sqes;
+
+	o->sq_ring  = sq;
+	o->cq_ring  = cq;
+	o->sq_tail  = (void *) ((char *) sq + p.sq_off.tail);
+	o->sq_mask  = (void *) ((char *) sq + p.sq_off.ring_mask);
+	o->sq_array = (void *) ((char *) sq + p.sq_off.array);
+	o->cq_head  = (void *) ((char *) cq + p.cq_off.head);
+	o->cq_tail  = (void *) ((char *) cq + p.cq_off.tail);
+	o->cq_mask  = (void *) ((char *) cq + p.cq_off.ring_mask);
+	o->cqes     = (void *) ((char *) cq + p.cq_off.cqes);
+	o->tail     = *o->sq_tail;
+	return o;
+no_sqes:
+	if (cq != sq)
+		munmap (cq, o->cq_size);
+no_cq:
+	munmap (sq, o->sq_size);
+no_sq:
+no_probe:
+	close (o->fd);
+no_ring:
+	free (o);
+	return NULL;
+}
+
+void pfp_uring_free (struct pfp_uring *o)
+{
+	if (o == NULL)
+		return;
+
+	munmap (o->sqes, o->entries * sizeof (o->sqes[0]));
+
+	if (o->cq_size != 0)
+		munmap (o->cq_ring, o->cq_size);
+
+	munmap (o->sq_ring, o->sq_size);
+	close (o->fd);
+	free (o);
+}
+
+static struct io_uring_sqe *ring_get (struct pfp_uring *o)
+{
+	const unsigned i = o->tail++ & *o->sq_mask;
+	struct io_uring_sqe *e = o->sqes + i;
+
+	o->sq_array[i] = i;
+	memset (e, 0, sizeof (*e));
+	return e;
+}
+
+static unsigned ring_ready (struct pfp_uring *o)
+{
+	return __atomic_load_n (o->cq_tail, __ATOMIC_ACQUIRE) - *o->cq_head;
+}
+
+/*
+ * Submit count queued entries and wait for all of them to complete. If
+ * the kernel fails to take some entries they are dropped from the queue
+ * and completions of taken ones are still waited for, thus nothing is
+ * left in flight. Returns zero with errno set on failure, the number of
+ * taken entries is returned in done anyway.
+ */
+static int ring_enter (struct pfp_uring *o, unsigned count, unsigned *done)
+{
+	int n, error = 0;
+
+	*done = 0;
+	__atomic_store_n (o->sq_tail, o->tail, __ATOMIC_RELEASE);
+
+	while (*done < count || ring_ready (o) < count) {
+		n = syscall (__NR_io_uring_enter, o->fd, count - *done, count,
+			     IORING_ENTER_GETEVENTS, NULL, 0);
+
+		if (n >= 0) {
+			*done += n;
+			continue;
+		}
+
+		if (errno == EINTR)
+			continue;
+
+		error = errno;
+
+		if (*done == count)
+			break;
+
+		o->tail -= count - *done;
+		__atomic_store_n (o->sq_tail, o->tail, __ATOMIC_RELEASE);
+		count = *done;
+	}
+
+	errno = error;
+	return error == 0;
+}
+
+/* pass every completion to the callback and mark it consumed */
+static void ring_reap (struct pfp_uring *o, struct pfp_read *set,
+		       void (*fn) (struct pfp_read *set, __u64 key, int res))
+{
+	const unsigned tail = __atomic_load_n (o->cq_tail, __ATOMIC_ACQUIRE);
+	unsigned head = *o->cq_head;
+	struct io_uring_cqe *e;
+
+	for (; head != tail; ++head) {
+		e = o->cqes + (head & *o->cq_mask);
+		fn (set, e->user_data, e->res);
+	}
+
+	__atomic_store_n (o->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void on_open (struct pfp_read *set, __u64 key, int res)
+{
+	set[key].len = res;  /* file descriptor until read */
+}
+
+static void on_read (struct pfp_read *set, __u64 key, int res)
+{
+	if ((key & 1) == 0)  /* skip close */
+		set[key / 2].len = res;
+}
+
+/* close files opened but not read, used on failure */
+static void close_opened (struct pfp_read *set, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; ++i)
+		if (set[i].len >= 0) {
+			close (set[i].len);
+			set[i].len = -ECANCELED;
+		}
+}
+
+/*
+ * Close files which close was not submitted for, used on failure. Read
+ * and close of n-th opened file are entries 2n and 2n + 1.
+ */
+static void close_rest (struct pfp_read *set, size_t count, unsigned done)
+{
+	size_t i;
+	unsigned n;
+
+	for (n = 0, i = 0; i < count; ++i) {
+		if (set[i].len < 0)
+			continue;
+
+		if (n + 1 >= done) {
+			close (set[i].len);
+
+			if (n >= done)
+				set[i].len = -ECANCELED;
+		}
+
+		n += 2;
+	}
+}
+
+/*
+ * Two round trips per chunk: open all the files, then read every opened
+ * one with close linked to the read. The link is hard to close file
+ * even if read failed. On failure no descriptor is left open.
+ */
+static int read_chunk (struct pfp_uring *o, struct pfp_read *set, size_t count)
+{
+	struct io_uring_sqe *e;
+	size_t i;
+	unsigned n, done;
+	int error;
+
+	for (i = 0; i < count; ++i) {
+		e = ring_get (o);
+		e->opcode     = IORING_OP_OPENAT;
+		e->fd         = AT_FDCWD;
+		e->addr       = (unsigned long) set[i].path;
+		e->open_flags = O_RDONLY | O_CLOEXEC;
+		e->user_data  = i;
+
+		set[i].len = -ECANCELED;  /* if not submitted */
+	}
+
+	if (!ring_enter (o, count, &done)) {
+		error = errno;
+		ring_reap (o, set, on_open);
+		close_opened (set, count);
+		errno = error;
+		return 0;
+	}
+
+	ring_reap (o, set, on_open);
+
+	for (n = 0, i = 0; i < count; ++i) {
+		if (set[i].len < 0)
+			continue;
+
+		e = ring_get (o);
+		e->opcode    = IORING_OP_READ;
+		e->flags     = IOSQE_IO_HARDLINK;
+		e->fd        = set[i].len;
+		e->addr      = (unsigned long) set[i].buf;
+		e->len       = set[i].size;
+		e->user_data = i * 2;
+
+		e = ring_get (o);
+		e->opcode    = IORING_OP_CLOSE;
+		e->fd        = set[i].len;
+		e->user_data = i * 2 + 1;
+
+		n += 2;
+	}
+
+	if (!ring_enter (o, n, &done)) {
+		error = errno;
+		close_rest (set, count, done);  /* before reap replaces fds */
+		ring_reap (o, set, on_read);
+		errno = error;
+		return 0;
+	}
+
+	ring_reap (o, set, on_read);
+	return 1;
+}
+
+int pfp_uring_read (struct pfp_uring *o, struct pfp_read *set, size_t count)
+{
+	const size_t chunk = o->entries / 2;  /* read and close per file */
+	size_t n;
+
+	for (; count > 0; set += n, count -= n) {
+		n = count < chunk ? count : chunk;
+
+		if (!read_chunk (o, set, n))
+			return 0;
+	}
+
+	return 1;
+}
+
+#else  /* no io_uring */
+
+struct pfp_uring *pfp_uring_alloc (unsigned entries)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+void pfp_uring_free (struct pfp_uring *o)
+{
+}
+
+int pfp_uring_read (struct pfp_uring *o, struct pfp_read *set, size_t count)
+{
+	errno = ENOSYS;
+	return 0;
+}
+
+#endif
@@ -0,0 +1,34 @@
+/*
+ * PCI Finger-Print Batched File Reader
+ *
+ * Copyright (c) 2016-2024 Alexei A. Smekalkine <ikle@ikle.ru>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef PFP_URING_H
+#define PFP_URING_H  1
+
+#include <stddef.h>
+
+/*
+ * Set of small files read at once with io_uring: opens, reads from the
+ * start and closes are submitted in batches, thus a few system calls
+ * are made for thousands of files. Alloc returns NULL with errno set if
+ * io_uring or any of required operations is not supported, the caller
+ * should read files itself then.
+ */
+struct pfp_read {
+	char path[64];
+	void *buf;
+	unsigned size;
+	int len;  /* number of bytes read or negative error code */
+};
+
+struct pfp_uring *pfp_uring_alloc (unsigned entries);
+void pfp_uring_free (struct pfp_uring *o);
+
+/* returns zero with errno set if ring failed, it should be freed then */
+int pfp_uring_read (struct pfp_uring *o, struct pfp_read *set, size_t count);
+
+#endif  /* PFP_URING_H */
@@ -0,0 +1,85 @@
+/*
+ * PCI Finger-Print Directory Tree Walker
+ *
+ * Copyright (c) 2016-2024 Alexei A. Smekalkine <ikle@ikle.ru>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dirent.h>
+
+#include "pfp-walk.h"
+
+/* directories from the root of walk down to the current one */
+struct level {
+	const struct level *up;
+	dev_t dev;
+	ino_t ino;
+};
+
+static int walk (const char *path, const struct level *up,
+		 pfp_walk_fn *fn, void *cookie);
+
+static int walk_dir (const char *path, const struct stat *st,
+		     const struct level *up, pfp_walk_fn *fn, void *cookie)
+{
+	const struct level l = { up, st->st_dev, st->st_ino };
+	const struct level *p;
+	const size_t len = strlen (path);
+	const char *sep = len > 0 && path[len - 1] == '/' ? "" : "/";
+	DIR *d;
+	struct dirent *e;
+	char *name;
+	size_t size;
+	int ok = 1;
+
+	for (p = up; p != NULL; p = p->up)
+		if (p->dev == l.dev && p->ino == l.ino)
+			return 1;  /* link to an upper directory */
+
+	if ((d = opendir (path)) == NULL)
+		return up != NULL;
+
+	while (ok && (e = readdir (d)) != NULL) {
+		if (strcmp (e->d_name, ".") == 0 ||
+		    strcmp (e->d_name, "..") == 0)
+			continue;
+
+		size = len + strlen (e->d_name) + 2;
+
+		if ((name = malloc (size)) == NULL) {
+			ok = 0;
+			break;
+		}
+
+		snprintf (name, size, "%s%s%s", path, sep, e->d_name);
+		ok = walk (name, &l, fn, cookie);
+		free (name);
+	}
+
+	closedir (d);
+	return ok;
+}
+
+static int walk (const char *path, const struct level *up,
+		 pfp_walk_fn *fn, void *cookie)
+{
+	struct stat st;
+
+	if (stat (path, &st) != 0)
+		return up != NULL;  /* dangling link in the tree */
+
+	if (S_ISDIR (st.st_mode))
+		return walk_dir (path, &st, up, fn, cookie);
+
+	return !S_ISREG (st.st_mode) || fn (path, &st, cookie);
+}
+
+int pfp_walk (const char *path, pfp_walk_fn *fn, void *cookie)
+{
+	return walk (path, NULL, fn, cookie);
+}
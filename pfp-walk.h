@@ -0,0 +1,27 @@
+/*
+ * PCI Finger-Print Directory Tree Walker
+ *
+ * Copyright (c) 2016-2024 Alexei A. Smekalkine <ikle@ikle.ru>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef PFP_WALK_H
+#define PFP_WALK_H  1
+
+#include <sys/stat.h>
+
+/*
+ * Call fn for every regular file of directory tree, or for the file
+ * itself if path names one. Symbolic links are followed, directory
+ * loops are skipped as well as entries that cannot be read. Unlike ftw
+ * the state is passed with cookie, thus walks are reentrant. The walk
+ * stops as soon as fn returns zero. Returns zero with errno set if path
+ * cannot be read or on failure.
+ */
+typedef int pfp_walk_fn (const char *path, const struct stat *st,
+			 void *cookie);
+
+int pfp_walk (const char *path, pfp_walk_fn *fn, void *cookie);
+
+#endif  /* PFP_WALK_H */
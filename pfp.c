@@ -10,31 +10,99 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include <ftw.h>
+#include <unistd.h>
 
-#include "pfp-parser.h"
-#include "pfp-scanner.h"
+#include "pfp.h"
+#include "pfp-builtin.h"
 
 int verbose;
+static int workers;
+static int batch;
+static int attrs = PFP_ATTR_NAME;
+static const char *cache_path;
+static int format = PFP_FORMAT_TEXT;
+
+static int show (const struct pfp_rule *r)
+{
+	struct pfp_buf b;
+	int ok;
+
+	pfp_buf_init (&b);
+
+	if (!(ok = pfp_format (&b, r, format, verbose) &&
+		   pfp_buf_flush (&b, stdout)))
+		perror ("pfp show");
+
+	pfp_buf_fini (&b);
+	return ok;
+}
+
+static struct pfp_rule *scan (int fill, const char *class, const char *who)
+{
+	struct pfp_scanner *s;
+	struct pfp_rule *r;
+	const char *reason;
+
+	if ((s = pfp_scanner_alloc ()) == NULL) {
+		perror (who);
+		return NULL;
+	}
+
+	pfp_scanner_workers (s, workers > 0 ? workers :
+				sysconf (_SC_NPROCESSORS_ONLN));
+	pfp_scanner_batch (s, batch);
+
+	if ((r = pfp_scanner_run (s, fill, class)) == NULL) {
+		if ((reason = pfp_scanner_error (s)) != NULL)
+			fprintf (stderr, "%s: %s\n", who, reason);
+		else
+			perror (who);
+	}
+
+	pfp_scanner_free (s);
+	return r;
+}
+
+static struct pfp_rule *load (FILE *from, const char *who)
+{
+	struct pfp_parser *p;
+	struct pfp_rule *r;
+	const char *reason;
+	int line;
+
+	if ((p = pfp_parser_alloc (NULL)) == NULL) {
+		perror (who);
+		return NULL;
+	}
+
+	if ((r = pfp_load (p, from)) == NULL) {
+		if ((reason = pfp_parser_error (p, &line)) != NULL)
+			fprintf (stderr, "E:%d: %s\n", line, reason);
+		else
+			perror (who);
+	}
+
+	pfp_parser_free (p);
+	return r;
+}
 
 static int do_scan (void)
 {
 	struct pfp_rule *r;
+	int ok;
 
-	if ((r = pfp_scan (1, NULL)) == NULL) {
-		perror ("pfp scan");
+	if ((r = scan (attrs, NULL, "pfp scan")) == NULL)
 		return 1;
-	}
 
 	if ((r = pfp_rule_sort (r)) == NULL) {
 		perror ("pfp sort");
 		return 1;
 	}
 
-	pfp_rule_show (r, stdout);
+	ok = show (r);
 	pfp_rule_free (r);
 
-	return 0;
+	return ok ? 0 : 1;
 }
 
 static int parse_slot (const char *slot, struct pfp_sbdf *o)
@@ -56,28 +124,35 @@ static int parse_slot (const char *slot, struct pfp_sbdf *o)
 static int do_path (const char *slot)
 {
 	struct pfp_sbdf sbdf;
-	struct pfp_rule *list;
-	const struct pfp_rule *r;
+	char *path;
 
 	if (!parse_slot (slot, &sbdf)) {
 		fprintf (stderr, "pfp path: cannot parse SBDF\n");
 		return 1;
 	}
 
-	if ((list = pfp_scan (0, NULL)) == NULL) {
+	if ((path = pfp_sysfs_path (&sbdf)) == NULL) {
 		perror ("pfp path");
 		return 1;
 	}
 
-	if ((r = pfp_rule_search (list, &sbdf)) == NULL || r->path == NULL)
-		goto no_device;
+	printf ("%s\n", path);
+	free (path);
+	return 0;
+}
 
-	printf ("%s\n", r->path);
-	pfp_rule_free (list);
+static int do_slot (const char *path)
+{
+	struct pfp_sbdf sbdf;
+
+	if (!pfp_sysfs_slot (path, &sbdf)) {
+		perror ("pfp slot");
+		return 1;
+	}
+
+	printf ("%04x:%02x:%02x.%o\n", sbdf.segment, sbdf.bus, sbdf.device,
+		sbdf.function);
 	return 0;
-no_device:
-	pfp_rule_free (list);
-	return 1;
 }
 
 static int do_lookup (const char *path, const char *class)
@@ -86,10 +161,8 @@ static int do_lookup (const char *path, const char *class)
 	const struct pfp_rule *o;
 	const char *p;
 
-	if ((list = pfp_scan (1, class)) == NULL) {
-		perror ("pfp path");
+	if ((list = scan (PFP_ATTR_NAME, class, "pfp lookup")) == NULL)
 		return 1;
-	}
 
 	for (o = list; o != NULL; o = o->next)
 		if (o->path != NULL && strcmp (path, o->path) == 0)
@@ -109,36 +182,31 @@ no_name:
 static int do_parse (void)
 {
 	struct pfp_rule *r;
+	int ok;
 
-	if ((r = pfp_parse (stdin)) == NULL) {
-		perror ("pfp parse");
+	if ((r = load (stdin, "pfp parse")) == NULL)
 		return 1;
-	}
 
 	if ((r = pfp_rule_sort (r)) == NULL) {
 		perror ("pfp sort");
 		return 1;
 	}
 
-	pfp_rule_show (r, stdout);
+	ok = show (r);
 	pfp_rule_free (r);
 
-	return 0;
+	return ok ? 0 : 1;
 }
 
-static int pfp_match (FILE *f, size_t *rank, size_t *count)
+static int match_file (FILE *f, size_t *rank, size_t *count)
 {
 	struct pfp_rule *r, *pattern;
 
-	if ((r = pfp_scan (0, NULL)) == NULL) {
-		perror ("pfp scan");
+	if ((r = scan (0, NULL, "pfp scan")) == NULL)
 		goto no_scan;
-	}
 
-	if ((pattern = pfp_parse (f)) == NULL) {
-		perror ("pfp parse");
+	if ((pattern = load (f, "pfp parse")) == NULL)
 		goto no_parse;
-	}
 
 	*count = pfp_rule_count (pattern);
 	*rank  = pfp_rule_match (r, pattern);
@@ -152,58 +220,187 @@ no_scan:
 	return 0;
 }
 
-static struct ctx {
-	size_t rank;
-	char *path;
-} walk_ctx;
+static int do_diff (void)
+{
+	struct pfp_rule *r, *pattern;
+	struct pfp_buf b;
+	long count;
+
+	if ((r = scan (0, NULL, "pfp scan")) == NULL)
+		goto no_scan;
 
-static int match_walker (const char *path, const struct stat *sb, int type)
+	if ((r = pfp_rule_sort (r)) == NULL) {
+		perror ("pfp sort");
+		goto no_scan;
+	}
+
+	if ((pattern = load (stdin, "pfp parse")) == NULL)
+		goto no_parse;
+
+	pfp_buf_init (&b);
+
+	if ((count = pfp_diff (r, pattern, &b, verbose)) < 0 ||
+	    (count > 0 && !pfp_buf_printf (&b, "\n")) ||
+	    !pfp_buf_flush (&b, stdout))
+		perror ("pfp diff");
+
+	pfp_buf_fini (&b);
+	pfp_rule_free (pattern);
+	pfp_rule_free (r);
+	return count < 0 ? 1 : count > 0 ? 2 : 0;
+no_parse:
+	pfp_rule_free (r);
+no_scan:
+	return 1;
+}
+
+static int load_corpus (struct pfp_corpus *c, char *dirs[])
 {
-	const char *dot;
-	FILE *f;
-	size_t rank, count;
+	pfp_corpus_init (c);
 
-	if (type != FTW_F)
+	if (cache_path != NULL &&
+	    (c->cache = pfp_cache_open (cache_path)) == NULL)
 		return 0;
 
-	if ((dot = strrchr (path, '.')) == NULL || strcmp (dot, ".pfp") != 0)
-		return 0;
+	for (; dirs[0] != NULL; ++dirs)
+		if (!pfp_corpus_load (c, dirs[0]))
+			return 0;
 
-	if ((f = fopen (path, "r")) == NULL)
-		goto no_open;
+	return 1;
+}
 
-	if (!pfp_match (f, &rank, &count))
-		goto no_match;
+static void corpus_error (struct pfp_corpus *c, const char *who)
+{
+	if (c->error != NULL)
+		fprintf (stderr, "E:%s\n", c->error);
+	else
+		perror (who);
+}
+
+static void free_corpus (struct pfp_corpus *c)
+{
+	if (!pfp_cache_close (c->cache))
+		perror ("pfp cache");
 
-	if (rank == count && walk_ctx.rank < rank) {
-		walk_ctx.rank = rank;
-		free (walk_ctx.path);
-		walk_ctx.path = strdup (path);
+	pfp_corpus_fini (c);
+}
+
+static int match_corpus (const struct pfp_corpus *c)
+{
+	struct pfp_rule *r;
+	struct pfp_index index;
+	const struct pfp_print *p, *best = NULL;
+	size_t i, rank, best_rank = 0, *memo;
+	int ret = 1;
+
+	if ((r = scan (0, NULL, "pfp scan")) == NULL)
+		return 1;
+
+	if (!pfp_index_init (&index, r)) {
+		perror ("pfp index");
+		goto no_index;
 	}
 
-	if (verbose > 0)
-		printf ("%s: %zd/%zd\n", path, rank, count);
+	memo = pfp_corpus_memo (c);
 
-	fclose (f);
-	return 0;
+	for (i = 0; i < c->count; ++i) {
+		p = c->set + i;
+
+		if (!pfp_print_match (c, p, &index, memo, &rank)) {
+			perror ("pfp match");
+			goto no_match;
+		}
+
+		if (rank == p->count && best_rank < rank) {
+			best_rank = rank;
+			best = p;
+		}
+
+		if (verbose > 0)
+			printf ("%s: %zd/%zd\n", p->name, rank, p->count);
+	}
+
+	if (best != NULL)
+		printf ("%s\n", best->name);
+
+	ret = best != NULL ? 0 : 2;
 no_match:
-	fclose (f);
-no_open:
-	return -1;
+	free (memo);
+	pfp_index_fini (&index);
+no_index:
+	pfp_rule_free (r);
+	return ret;
 }
 
-static int do_match_dirs (char *argv[])
+/*
+ * Print k best partial matches, best one first. Full matches are ranked
+ * by score as well, the exit status tells whether any of the corpus
+ * matches fully as with match_corpus.
+ */
+static int match_top (size_t k, const struct pfp_corpus *c)
 {
-	for (; argv[0] != NULL; ++argv)
-		if (ftw (argv[0], match_walker, 1000) < 0)
-			return 1;
+	struct pfp_rule *r;
+	struct pfp_score *top;
+	const struct pfp_print *best;
+	size_t i, rank;
+	int ret = 1;
+
+	if ((top = malloc (sizeof (top[0]) * k)) == NULL) {
+		perror ("pfp match");
+		return 1;
+	}
 
-	if (walk_ctx.path == NULL)
-		return 2;
+	if ((r = scan (0, NULL, "pfp scan")) == NULL)
+		goto no_scan;
 
-	printf ("%s\n", walk_ctx.path);
-	free (walk_ctx.path);
-	return 0;
+	if (!pfp_corpus_rank (c, r, top, &k)) {
+		perror ("pfp match");
+		goto no_rank;
+	}
+
+	for (i = 0; i < k; ++i)
+		printf ("%s: %.3f %zd/%zd\n", top[i].print->name,
+			(double) top[i].rank / top[i].total,
+			top[i].rank, top[i].print->count);
+
+	if (!pfp_corpus_match (c, r, &best, &rank)) {
+		perror ("pfp match");
+		goto no_rank;
+	}
+
+	ret = best != NULL ? 0 : 2;
+no_rank:
+	pfp_rule_free (r);
+no_scan:
+	free (top);
+	return ret;
+}
+
+static int is_builtin (char *argv[])
+{
+	return argv[0] != NULL && strcmp (argv[0], "--builtin") == 0 &&
+	       argv[1] == NULL;
+}
+
+/* k best matches if k is positive, the best full match otherwise */
+static int do_match_dirs (size_t k, char *argv[])
+{
+	struct pfp_corpus c;
+	int ret = 1;
+
+	if (is_builtin (argv))
+		return k > 0 ? match_top (k, &pfp_builtin) :
+			       match_corpus (&pfp_builtin);
+
+	if (!load_corpus (&c, argv)) {
+		corpus_error (&c, "pfp match");
+		goto no_corpus;
+	}
+
+	ret = k > 0 ? match_top (k, &c) : match_corpus (&c);
+no_corpus:
+	free_corpus (&c);
+	return ret;
 }
 
 static int do_match (char *argv[])
@@ -211,9 +408,9 @@ static int do_match (char *argv[])
 	size_t rank, count;
 
 	if (argv[0] != NULL)
-		return do_match_dirs (argv);
+		return do_match_dirs (0, argv);
 
-	if (!pfp_match (stdin, &rank, &count))
+	if (!match_file (stdin, &rank, &count))
 		return 1;
 
 	if (verbose > 0)
@@ -222,34 +419,119 @@ static int do_match (char *argv[])
 	return rank != count ? 2 : 0;
 }
 
-int main (int argc, char *argv[])
+static int do_classify (const char *snapshots, const char *corpus)
 {
-	while (argc > 1 && strcmp (argv[1], "-v") == 0) {
-		--argc, ++argv;
-		++verbose;
+	char *dirs[] = { (char *) corpus, NULL };
+	struct pfp_corpus c;
+	struct pfp_snapshot *set;
+	size_t count, i;
+
+	if (!load_corpus (&c, dirs)) {
+		corpus_error (&c, "pfp classify");
+		goto no_corpus;
+	}
+
+	if (workers <= 0)
+		workers = sysconf (_SC_NPROCESSORS_ONLN);
+
+	if (!pfp_classify (&c, snapshots, workers, &set, &count)) {
+		perror ("pfp classify");
+		goto no_classify;
 	}
 
+	for (i = 0; i < count; ++i)
+		if (!set[i].ok)
+			printf ("%s: error\n", set[i].path);
+		else if (set[i].print == NULL)
+			printf ("%s: -\n", set[i].path);
+		else
+			printf ("%s: %s %zd\n", set[i].path,
+				set[i].print->name, set[i].rank);
+
+	pfp_snapshot_free (set, count);
+	free_corpus (&c);
+	return 0;
+no_classify:
+no_corpus:
+	free_corpus (&c);
+	return 1;
+}
+
+int main (int argc, char *argv[])
+{
+	cache_path = getenv ("PFP_CACHE");
+
+	for (; argc > 1 && argv[1][0] == '-'; --argc, ++argv)
+		if (strcmp (argv[1], "-v") == 0)
+			++verbose;
+		else if (strcmp (argv[1], "-u") == 0)
+			batch = 1;
+		else if (strcmp (argv[1], "-c") == 0 && argc > 2) {
+			cache_path = argv[2];
+			--argc, ++argv;
+		}
+		else if (strcmp (argv[1], "-a") == 0 && argc > 2) {
+			if ((attrs = pfp_attr_parse (argv[2])) < 0)
+				goto usage;
+
+			--argc, ++argv;
+		}
+		else if (strcmp (argv[1], "-j") == 0 && argc > 2) {
+			workers = atoi (argv[2]);
+			--argc, ++argv;
+		}
+		else if (strncmp (argv[1], "--format=", 9) == 0) {
+			if ((format = pfp_format_parse (argv[1] + 9)) < 0)
+				goto usage;
+		}
+		else
+			break;
+
 	if (argc == 2 && strcmp (argv[1], "scan") == 0)
 		return do_scan ();
 
 	if (argc == 3 && strcmp (argv[1], "path") == 0)
 		return do_path (argv[2]);
 
+	if (argc == 3 && strcmp (argv[1], "slot") == 0)
+		return do_slot (argv[2]);
+
 	if (argc == 4 && strcmp (argv[1], "lookup") == 0)
 		return do_lookup (argv[2], argv[3]);
 
 	if (argc == 2 && strcmp (argv[1], "parse") == 0)
 		return do_parse ();
 
-	if (argc >= 2 && strcmp (argv[1], "match") == 0)
+	if (argc >= 5 && strcmp (argv[1], "match") == 0 &&
+	    strcmp (argv[2], "-k") == 0 && atoi (argv[3]) > 0)
+		return do_match_dirs (atoi (argv[3]), argv + 4);
+
+	if (argc >= 2 && strcmp (argv[1], "match") == 0 &&
+	    (argc < 3 || strcmp (argv[2], "-k") != 0))
 		return do_match (argv + 2);
 
+	if (argc == 2 && strcmp (argv[1], "diff") == 0)
+		return do_diff ();
+
+	if (argc == 4 && strcmp (argv[1], "classify") == 0)
+		return do_classify (argv[2], argv[3]);
+
+usage:
 	fprintf (stderr, "usage:\n"
-			 "\tpfp [-v] scan > out\n"
-			 "\tpfp [-v] path SBDF\n"
+			 "\tpfp [-v] [-u] [-j workers] [-a attr,...] "
+			 "[--format=text|json|bin] scan > out\n"
+			 "\tpfp path SBDF\n"
+			 "\tpfp slot PATH\n"
 			 "\tpfp [-v] lookup PATH CLASS\n"
-			 "\tpfp [-v] parse < in\n"
-			 "\tpfp [-v] match < in\n"
-			 "\tpfp [-v] match rule-directory ...\n");
+			 "\tpfp [-v] [--format=text|json|bin] parse < in\n"
+			 "\tpfp [-v] [-j workers] match < in\n"
+			 "\tpfp [-v] [-j workers] [-c cache] match "
+			 "rule-directory ...\n"
+			 "\tpfp [-j workers] [-c cache] match -k N "
+			 "rule-directory ...\n"
+			 "\tpfp [-v] [-j workers] match [-k N] --builtin\n"
+			 "\tpfp [-v] [-j workers] diff < in\n"
+			 "\tpfp [-c cache] [-j workers] classify snapshot-directory "
+			 "rule-directory\n");
 	return 1;
 }
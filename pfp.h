@@ -0,0 +1,30 @@
+/*
+ * PCI Finger-Print Library
+ *
+ * Copyright (c) 2016-2024 Alexei A. Smekalkine <ikle@ikle.ru>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef PFP_H
+#define PFP_H  1
+
+/*
+ * Library functions never terminate the process: on failure they return
+ * zero or NULL with errno set, parser and scanner keep failure reason
+ * to be queried with pfp_parser_error and pfp_scanner_error.
+ */
+
+#include "pfp-rule.h"
+#include "pfp-parser.h"
+#include "pfp-scanner.h"
+#include "pfp-format.h"
+#include "pfp-index.h"
+#include "pfp-assign.h"
+#include "pfp-diff.h"
+#include "pfp-cache.h"
+#include "pfp-corpus.h"
+#include "pfp-classify.h"
+#include "pfp-sysfs.h"
+
+#endif  /* PFP_H */